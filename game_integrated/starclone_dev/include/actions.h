@@ -36,6 +36,71 @@ static inline action_state copy_state(const action_state& action_st, const state
 	return r;
 }
 
+// The size of the data of an action that follows its action id, which data
+// (data_size bytes) starts with, or ~(size_t)0 if the action id is unknown or
+// the action is invalid or does not fit in data_size bytes. This is the number
+// of bytes action_functions::read_action reads, without executing the action.
+static inline size_t action_data_size(int action_id, const uint8_t* data, size_t data_size) {
+	const size_t invalid = ~(size_t)0;
+	auto fixed = [&](size_t n) {
+		return n <= data_size ? n : invalid;
+	};
+	switch (action_id) {
+	case 9:
+	case 10:
+	case 11:
+		if (data_size < 1 || data[0] > 12) return invalid;
+		return fixed(1 + 2 * (size_t)data[0]);
+	case 12: return fixed(7);
+	case 13: return fixed(2);
+	case 14: return fixed(4);
+	case 18: return fixed(4);
+	case 19: return fixed(2);
+	case 20: return fixed(9);
+	case 21: return fixed(10);
+	case 24: return fixed(0);
+	case 25: return fixed(0);
+	case 26: return fixed(1);
+	case 27: return fixed(0);
+	case 28: return fixed(0);
+	case 30: return fixed(1);
+	case 31: return fixed(2);
+	case 32: return fixed(2);
+	case 33: return fixed(1);
+	case 34: return fixed(1);
+	case 35: return fixed(2);
+	case 37: return fixed(1);
+	case 38: return fixed(1);
+	case 39: return fixed(0);
+	case 40: return fixed(1);
+	case 41: return fixed(2);
+	case 42: return fixed(0);
+	case 43: return fixed(1);
+	case 44: return fixed(1);
+	case 45: return fixed(1);
+	case 46: return fixed(0);
+	case 47: return fixed(4);
+	case 48: return fixed(1);
+	case 49: return fixed(0);
+	case 50: return fixed(1);
+	case 51: return fixed(0);
+	case 52: return fixed(0);
+	case 53: return fixed(2);
+	case 54: return fixed(0);
+	case 87: return fixed(1);
+	case 88: return fixed(4);
+	case 90: return fixed(0);
+	case 92: return fixed(81);
+	case 210:
+		if (data_size < 2) return invalid;
+		if (data[0] == 0 && data[1] <= 2) return fixed(8);
+		if (data[0] == 1 && data[1] <= 1) return fixed(5);
+		if (data[0] == 1 && data[1] <= 3) return fixed(7);
+		return invalid;
+	}
+	return invalid;
+}
+
 struct action_functions: state_functions {
 	action_state& action_st;
 	explicit action_functions(state& st, action_state& action_st) : state_functions(st), action_st(action_st) {}
@@ -180,6 +245,24 @@ struct action_functions: state_functions {
 		g.target_pos = target_pos;
 	}
 
+	// The long paths that the selected ground units of owner would take for a
+	// group move to target_pos, one pathfinder per unit in selection order, as
+	// by pathfinder_find_long_paths. Does not issue any orders.
+	a_vector<pathfinder> group_move_long_paths(int owner, xy target_pos, bool share_by_region) {
+		a_vector<pathfinder> r;
+		group_move_t g;
+		calc_group_move(g, owner, target_pos, true);
+		for (unit_t* u : selected_units(owner)) {
+			if (u_flying(u) || !unit_can_move(u)) continue;
+			r.emplace_back();
+			r.back().u = u;
+			r.back().source = u->sprite->position;
+			r.back().destination = get_group_move_pos(u, target_pos, g);
+		}
+		pathfinder_find_long_paths(r, share_by_region);
+		return r;
+	}
+
 	xy get_group_move_pos(const unit_t* u, xy pos, const group_move_t& g) const {
 		xy target_pos = u->pathing_flags & 1 ? g.target_pos : g.original_target_pos;
 		if (g.target_is_in_unit_bounds) {
@@ -5,14 +5,29 @@
 #include "data_types.h"
 #include "game_types.h"
 #include "data_loading.h"
+#include "data_files_cache.h"
 #include "bwenums.h"
 #include "korean.h"
+#include "frame_profiler.h"
 
 #include <algorithm>
 #include <utility>
 #include <cstdlib>
 #include <cmath>
 #include <functional>
+#include <memory>
+#include <mutex>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BWGAME_SIMD_SSE2
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define BWGAME_SIMD_NEON
+#elif defined(__wasm_simd128__)
+#include <wasm_simd128.h>
+#define BWGAME_SIMD_WASM
+#endif
 
 namespace bwgame {
 
@@ -186,6 +201,10 @@ struct game_state {
 
 	regions_t regions;
 
+	// Ground units follow flow fields instead of the pathfinder, see
+	// state_functions::flow_field_path_to. Not part of the original game.
+	bool flow_field_movement = false;
+
 	a_vector<trigger> triggers;
 };
 
@@ -240,6 +259,8 @@ struct state_base_copyable {
 
 	int last_error;
 
+	uint64_t units_sync_hash;
+
 	int trigger_timer;
 	std::array<a_vector<running_trigger>, 8> running_triggers;
 	std::array<int, 12> trigger_wait_timers;
@@ -315,12 +336,28 @@ struct state_base_non_copyable {
 	intrusive_list<thingy_t, default_link_f> free_thingies;
 	a_list<thingy_t> thingies;
 
+#ifdef BWGAME_GRID_UNIT_FINDER
+	struct unit_finder_grid_t {
+		size_t width = 0;
+		size_t height = 0;
+		a_vector<a_vector<unit_t*>> cells;
+		int64_t front_order = 0;
+		int64_t back_order = 0;
+	};
+	unit_finder_grid_t unit_finder_grid;
+#else
 	struct unit_finder_entry {
 		unit_t* u;
 		int value;
+		uint32_t index;
 	};
 	a_vector<unit_finder_entry> unit_finder_x;
 	a_vector<unit_finder_entry> unit_finder_y;
+#endif
+	// unit_t::unit_finder_bounding_box of every unit, indexed by unit_t::index.
+	// The unit finder keeps it in sync, so that searches can reject candidates
+	// without touching their unit_t.
+	a_vector<rect> unit_finder_bounding_boxes;
 
 	const unit_t* consider_collision_with_unit_bug;
 	const unit_t* prev_bullet_source_unit;
@@ -329,6 +366,16 @@ struct state_base_non_copyable {
 struct state : state_base_copyable, state_base_non_copyable {
 };
 
+// The read-only phase that follows each frame of state_functions::next_frame
+// (see frame_readers.h). begin is called with the state once the frame is
+// done, and must not modify it. end is called before anything modifies the
+// state again, and must not return while anything still reads it.
+struct frame_read_phase {
+	virtual ~frame_read_phase() {}
+	virtual void begin(const state& st) = 0;
+	virtual void end() = 0;
+};
+
 struct state_functions {
 
 	virtual void play_sound(int id, xy position, const unit_t* source_unit = nullptr, bool add_race_index = false) {}
@@ -356,6 +403,85 @@ struct state_functions {
 	unit_t* iscript_unit = nullptr;
 	mutable size_t unit_finder_search_index = 0;
 
+	struct pathfinder_long_path_node {
+		pathfinder_long_path_node* prev = nullptr;
+		xy_fp8 pos;
+		const regions_t::region* region = nullptr;
+		fp8 total_cost{};
+		fp8 estimated_remaining_cost{};
+		fp8 estimated_final_cost{};
+		bool visited = false;
+	};
+	// Working memory of the pathfinder searches, kept between calls so that
+	// searches do not allocate once the vectors have grown to their caps.
+	// The searches only read game_st, so any number of them can run
+	// concurrently on the same game_state from different state_functions.
+	struct pathfinder_scratch_t {
+		a_vector<pathfinder_long_path_node> long_path_nodes;
+		a_vector<pathfinder_long_path_node*> long_path_open;
+		// Indexed by region::index, all null/zero between searches.
+		a_vector<pathfinder_long_path_node*> region_nodes;
+		a_vector<int> region_flags;
+		std::array<a_vector<regions_t::contour>, 4> local_edges;
+		a_vector<rect> visited_areas;
+	};
+	mutable pathfinder_scratch_t pathfinder_scratch;
+	// Rows of region distances computed by region_distance, keyed by the index
+	// of the source region. Cleared when the regions change or when max_rows
+	// is reached.
+	struct region_distance_cache_t {
+		size_t generation = 0;
+		size_t max_rows = 256;
+		a_unordered_map<size_t, a_vector<int>> rows;
+	};
+	mutable region_distance_cache_t region_distance_cache;
+	// Scratch space for computing flow fields, see flow_field_to.
+	struct flow_field_scratch_t {
+		a_vector<int> costs;
+		a_vector<std::pair<int, size_t>> open;
+	};
+	mutable flow_field_scratch_t flow_field_scratch;
+	// Keys of the reveal_sight_at calls made since the visibility reset of the
+	// current frame, see reveal_sight_at. Entries of older stamps are empty.
+	// The entries are allocated by the first begin_sight_reveal_set, so that
+	// state_functions objects that never update visibility stay small.
+	struct sight_reveal_set_t {
+		static const size_t capacity = 0x1000;
+		struct entry {
+			uint64_t key;
+			uint32_t stamp;
+		};
+		bool active = false;
+		uint32_t stamp = 0;
+		size_t size = 0;
+		a_vector<entry> entries;
+	};
+	mutable sight_reveal_set_t sight_reveal_set;
+	// Enables sight_tiles_cache and prepare_sight_tiles. Does not change
+	// results.
+	bool cache_sight_tiles = false;
+	struct sight_tiles_cache_t {
+		size_t max_entries = 0x1000;
+		size_t generation = 0;
+		a_unordered_map<uint64_t, a_vector<uint32_t>> tiles;
+		a_vector<uint32_t> scratch;
+	};
+	mutable sight_tiles_cache_t sight_tiles_cache;
+	frame_read_phase* read_phase = nullptr;
+#ifdef BWGAME_FRAME_PROFILER
+	frame_profiler* profiler = nullptr;
+#endif
+#ifdef BWGAME_GRID_UNIT_FINDER
+	struct unit_finder_grid_entry {
+		unit_t* u;
+		int value;
+		uint32_t index;
+		int64_t order;
+	};
+	mutable std::array<a_vector<unit_finder_grid_entry>, 12> unit_finder_grid_scratch;
+	mutable size_t unit_finder_grid_scratch_depth = 0;
+#endif
+
 	const order_type_t* get_order_type(Orders id) const {
 		if ((size_t)id >= 189) error("invalid order id %d", (size_t)id);
 		return &global_st.order_types.vec[(size_t)id];
@@ -923,8 +1049,63 @@ struct state_functions {
 		}
 	}
 
+	// st.units_sync_hash is the sum of unit_sync_hash over every unit that is not
+	// on the free list. Code that changes any of the fields hashed here calls
+	// update_unit_sync_hash afterwards, so the sum stays up to date without
+	// iterating over the units, and sync_hash can be checked every frame.
+	uint64_t unit_sync_hash(const unit_t* u) const {
+		uint64_t r = 0xcbf29ce484222325;
+		auto add = [&](uint64_t v) {
+			r = (r ^ v) * 0x100000001b3;
+		};
+		add(u->index);
+		add((uint32_t)u->owner);
+		add(u->unit_type ? (uint64_t)u->unit_type->id : ~(uint64_t)0);
+		add(u->order_type ? (uint64_t)u->order_type->id : ~(uint64_t)0);
+		add((uint32_t)u->hp.raw_value);
+		add((uint32_t)u->shield_points.raw_value);
+		add((uint32_t)u->exact_position.x.raw_value);
+		add((uint32_t)u->exact_position.y.raw_value);
+		// The terms are summed, so mix the bits well.
+		r ^= r >> 33;
+		r *= 0xff51afd7ed558ccd;
+		r ^= r >> 33;
+		return r;
+	}
+
+	void update_unit_sync_hash(unit_t* u) {
+		uint64_t h = unit_sync_hash(u);
+		st.units_sync_hash += h - u->sync_hash;
+		u->sync_hash = h;
+	}
+
+	void remove_unit_sync_hash(unit_t* u) {
+		st.units_sync_hash -= u->sync_hash;
+		u->sync_hash = 0;
+	}
+
+	// st.units_sync_hash combined with the random number state, the resources
+	// and the number of active objects.
+	uint32_t sync_hash() const {
+		uint64_t r = st.units_sync_hash;
+		auto add = [&](uint64_t v) {
+			r = (r ^ v) * 0x100000001b3;
+		};
+		add(st.lcg_rand_state);
+		add((uint32_t)st.total_random_counts);
+		for (auto v : st.current_minerals) add((uint32_t)v);
+		for (auto v : st.current_gas) add((uint32_t)v);
+		for (auto v : st.total_minerals_gathered) add((uint32_t)v);
+		for (auto v : st.total_gas_gathered) add((uint32_t)v);
+		add(st.active_orders_size);
+		add(st.active_bullets_size);
+		add(st.active_thingies_size);
+		return (uint32_t)(r ^ r >> 32);
+	}
+
 	void set_unit_hp(unit_t* u, fp8 hitpoints) {
 		u->hp = std::min(hitpoints, u->unit_type->hitpoints);
+		update_unit_sync_hash(u);
 		if (u_completed(u)) {
 			update_unit_damage_overlay(u);
 
@@ -935,6 +1116,7 @@ struct state_functions {
 
 	void set_unit_shield_points(unit_t* u, fp8 shield_points) {
 		u->shield_points = std::min(shield_points, fp8::integer(u->unit_type->shield_points));
+		update_unit_sync_hash(u);
 	}
 
 	void set_unit_energy(unit_t* u, fp8 energy) {
@@ -1216,6 +1398,7 @@ struct state_functions {
 			if (u->shield_points != max_shields) {
 				u->shield_points += 7_fp8;
 				if (u->shield_points > max_shields) u->shield_points = max_shields;
+				update_unit_sync_hash(u);
 			}
 		}
 		if (unit_is(u, UnitTypes::Zerg_Zergling) || unit_is(u, UnitTypes::Hero_Devouring_One)) {
@@ -2093,6 +2276,135 @@ struct state_functions {
 		return long_path_distance(from, to);
 	}
 
+	static constexpr int region_distance_unreachable = std::numeric_limits<int>::max();
+
+	// Shortest walking distances between region centers from source to every
+	// region, indexed by region::index. Only walkable regions are traversed.
+	a_vector<int> region_distances_from(const regions_t::region* source) const {
+		auto& regions = game_st.regions.regions;
+		a_vector<int> r(regions.size(), region_distance_unreachable);
+		if (!source->walkable()) return r;
+		using entry = std::pair<int, const regions_t::region*>;
+		auto cmp = [](const entry& a, const entry& b) {
+			return a.first > b.first;
+		};
+		a_vector<entry> open;
+		r[source->index] = 0;
+		open.emplace_back(0, source);
+		while (!open.empty()) {
+			std::pop_heap(open.begin(), open.end(), cmp);
+			entry cur = open.back();
+			open.pop_back();
+			if (cur.first != r[cur.second->index]) continue;
+			for (auto* n : cur.second->walkable_neighbors) {
+				int d = cur.first + xy_length(to_xy(n->center) - to_xy(cur.second->center));
+				if (d < r[n->index]) {
+					r[n->index] = d;
+					open.emplace_back(d, n);
+					std::push_heap(open.begin(), open.end(), cmp);
+				}
+			}
+		}
+		return r;
+	}
+
+	// A lower bound on region_distance(a, b) from the landmark distances, or
+	// region_distance_unreachable if a landmark shows b to be unreachable from a.
+	int region_distance_lower_bound(const regions_t::region* a, const regions_t::region* b) const {
+		int r = 0;
+		for (auto& v : game_st.regions.landmark_distances) {
+			int da = v[a->index];
+			int db = v[b->index];
+			if (da == region_distance_unreachable && db == region_distance_unreachable) continue;
+			if (da == region_distance_unreachable || db == region_distance_unreachable) return region_distance_unreachable;
+			r = std::max(r, std::abs(da - db));
+		}
+		return r;
+	}
+
+	// Distances from source as by region_distances_from, cached in
+	// region_distance_cache.
+	const a_vector<int>& region_distance_row(const regions_t::region* source) const {
+		auto& cache = region_distance_cache;
+		if (cache.generation != game_st.regions.generation) {
+			cache.rows.clear();
+			cache.generation = game_st.regions.generation;
+		}
+		auto i = cache.rows.find(source->index);
+		if (i != cache.rows.end()) return i->second;
+		if (cache.rows.size() >= cache.max_rows) cache.rows.clear();
+		return cache.rows.emplace(source->index, region_distances_from(source)).first->second;
+	}
+
+	// The shortest walking distance between the centers of a and b, or
+	// region_distance_unreachable. Each source region costs one search over
+	// the region graph, after which distances from it are looked up.
+	// This is not what the simulation uses, see long_path_distance.
+	int region_distance(const regions_t::region* a, const regions_t::region* b) const {
+		if (a == b) return 0;
+		if (region_distance_lower_bound(a, b) == region_distance_unreachable) return region_distance_unreachable;
+		if (region_distance_cache.generation == game_st.regions.generation) {
+			auto i = region_distance_cache.rows.find(b->index);
+			if (i != region_distance_cache.rows.end()) return i->second[a->index];
+		}
+		return region_distance_row(a)[b->index];
+	}
+
+	// Fills the region_distance cache with every walkable region, so that all
+	// following queries are lookups. Uses 4 bytes per pair of regions.
+	void precompute_region_distances() const {
+		auto& regions = game_st.regions.regions;
+		region_distance_cache.max_rows = std::max(region_distance_cache.max_rows, regions.size());
+		for (auto& v : regions) {
+			if (v.walkable()) region_distance_row(&v);
+		}
+	}
+
+	// The regions along a shortest walking path from a to b, both included, or
+	// an empty vector if b is unreachable. A* with the landmark lower bounds as
+	// heuristic. Unlike pathfinder_find_long_path, the search has no node limit
+	// and does not cross unwalkable regions; it is meant for queries outside
+	// of the simulation and does not affect it.
+	a_vector<const regions_t::region*> region_path(const regions_t::region* a, const regions_t::region* b) const {
+		a_vector<const regions_t::region*> r;
+		if (!a->walkable() || !b->walkable()) return r;
+		if (region_distance_lower_bound(a, b) == region_distance_unreachable) return r;
+		auto& regions = game_st.regions.regions;
+		a_vector<int> cost(regions.size(), region_distance_unreachable);
+		a_vector<const regions_t::region*> prev(regions.size());
+		struct entry {
+			int estimated_final_cost;
+			int cost;
+			const regions_t::region* region;
+		};
+		auto cmp = [](const entry& a, const entry& b) {
+			return a.estimated_final_cost > b.estimated_final_cost;
+		};
+		a_vector<entry> open;
+		cost[a->index] = 0;
+		open.push_back({region_distance_lower_bound(a, b), 0, a});
+		while (!open.empty()) {
+			std::pop_heap(open.begin(), open.end(), cmp);
+			entry cur = open.back();
+			open.pop_back();
+			if (cur.region == b) break;
+			if (cur.cost != cost[cur.region->index]) continue;
+			for (auto* n : cur.region->walkable_neighbors) {
+				int c = cur.cost + xy_length(to_xy(n->center) - to_xy(cur.region->center));
+				if (c < cost[n->index]) {
+					cost[n->index] = c;
+					prev[n->index] = cur.region;
+					open.push_back({c + region_distance_lower_bound(n, b), c, n});
+					std::push_heap(open.begin(), open.end(), cmp);
+				}
+			}
+		}
+		if (cost[b->index] == region_distance_unreachable) return r;
+		for (auto* n = b; n; n = prev[n->index]) r.push_back(n);
+		std::reverse(r.begin(), r.end());
+		return r;
+	}
+
 	void destroy_carrying_images(const unit_t* u) {
 		destroy_image_from_to(u->sprite, ImageTypes::IMAGEID_Mineral_Chunk_Shadow, ImageTypes::IMAGEID_Psi_Emitter_Shadow_Carried);
 		destroy_image_from_to(u->sprite, ImageTypes::IMAGEID_Flag, ImageTypes::IMAGEID_Terran_Gas_Tank_Type2);
@@ -2890,6 +3202,7 @@ struct state_functions {
 		if (u_completed(u)) add_completed_unit(u, -1, false);
 		st.player_units[u->owner].remove(*u);
 		u->owner = owner;
+		update_unit_sync_hash(u);
 		st.player_units[owner].push_front(*u);
 		increment_unit_counts(u, 1);
 		if (u_completed(u)) add_completed_unit(u, 1, increment_score);
@@ -2968,6 +3281,7 @@ struct state_functions {
 		if (u_grounded_building(u) && !u->build_queue.empty()) build_queue_clear_single(u);
 		if (ut_resource(u)) set_unit_resources(u, prev_resources);
 		if (was_hatchery && unit_is_hatchery(u)) u->building.hatchery.larva_spawn_side_values = prev_larva_spawn_side_values;
+		update_unit_sync_hash(u);
 	}
 
 	void morph_unit(unit_t* u, const unit_type_t* unit_type) {
@@ -3045,6 +3359,7 @@ struct state_functions {
 		morph_unit(target, unit_type);
 		create_image(get_image_type(ImageTypes::IMAGEID_Vespene_Geyser2), target->sprite, {}, image_order_below);
 		target->hp = unit_type->hitpoints / 10;
+		update_unit_sync_hash(target);
 		return target;
 	}
 
@@ -3984,6 +4299,7 @@ struct state_functions {
 		add_creep_provider(u);
 		set_construction_graphic(u, true);
 		u->hp = u->unit_type->hitpoints / 10;
+		update_unit_sync_hash(u);
 		if (!u->build_queue.empty()) build_queue_clear_single(u);
 		set_unit_order(u, get_order_type(Orders::IncompleteMorphing));
 	}
@@ -4027,6 +4343,7 @@ struct state_functions {
 		if (turret) {
 			turret->exact_position = u->exact_position;
 			turret->position = to_xy(turret->exact_position);
+			update_unit_sync_hash(turret);
 			move_sprite(turret->sprite, turret->position);
 		}
 		if (us_hidden(u)) {
@@ -4121,6 +4438,7 @@ struct state_functions {
 			if (can_move) {
 				if (unit_is_reaver(u)) u->order_type = get_order_type(Orders::ReaverFight);
 				else u->order_type = get_order_type(Orders::CarrierFight);
+				update_unit_sync_hash(u);
 			}
 			return can_attack_target();
 		} else {
@@ -4129,12 +4447,14 @@ struct state_functions {
 				if (can_move && u->order_type->id != Orders::CarrierIgnore2) {
 					if (unit_is_reaver(u)) u->order_type = get_order_type(Orders::Reaver);
 					else u->order_type = get_order_type(Orders::Carrier);
+					update_unit_sync_hash(u);
 				}
 				return false;
 			}
 			if (can_move) {
 				if (unit_is_reaver(u)) u->order_type = get_order_type(Orders::ReaverFight);
 				else u->order_type = get_order_type(Orders::CarrierFight);
+				update_unit_sync_hash(u);
 			}
 			u->order_target.pos = new_target->sprite->position;
 			u_set_status_flag(u, unit_t::status_flag_ready_to_attack);
@@ -4187,6 +4507,7 @@ struct state_functions {
 			return nullptr;
 		}
 		u->hp = u->unit_type->hitpoints;
+		update_unit_sync_hash(u);
 		make_unit_hallucination(u);
 		set_unit_order(u, u->unit_type->human_ai_idle);
 		if (unit_is_reaver(source_unit) && unit_is_reaver(u)) {
@@ -4228,6 +4549,7 @@ struct state_functions {
 	void order_Guard(unit_t* u) {
 		u->main_order_timer = lcg_rand(29, 0, 15);
 		u->order_type = get_order_type(Orders::PlayerGuard);
+		update_unit_sync_hash(u);
 	}
 
 	void order_PlayerGuard(unit_t* u) {
@@ -4601,6 +4923,7 @@ struct state_functions {
 						build_unit->connected_unit = u;
 						u->order_type = get_order_type(Orders::ConstructingBuilding);
 						u->order_state = 3;
+						update_unit_sync_hash(u);
 						u->order_target.unit = build_unit;
 						set_unit_order(build_unit, get_order_type(Orders::IncompleteBuilding));
 					} else {
@@ -5112,6 +5435,7 @@ struct state_functions {
 		set_next_target_waypoint(u, u->sprite->position - xy(0, 42));
 		if (unit_is(u, UnitTypes::Zerg_Infested_Command_Center)) remove_creep_provider(u);
 		u->order_type = get_order_type(Orders::LiftingOff);
+		update_unit_sync_hash(u);
 	}
 
 	void order_LiftingOff(unit_t* u) {
@@ -6707,6 +7031,7 @@ struct state_functions {
 		if (exit) {
 			set_construction_graphic(exit, true);
 			exit->hp = exit->unit_type->hitpoints / 10;
+			update_unit_sync_hash(exit);
 			set_unit_order(exit, get_order_type(Orders::IncompleteMorphing));
 			add_creep_provider(exit);
 			if (unit_is_nydus(u)) u->building.nydus.exit = exit;
@@ -6839,6 +7164,7 @@ struct state_functions {
 		increment_unit_counts(u, -1);
 		if (u_completed(u)) add_completed_unit(u, -1, false);
 		u->unit_type = new_type;
+		update_unit_sync_hash(u);
 		increment_unit_counts(u, 1);
 		if (u_completed(u)) add_completed_unit(u, 1, false);
 		set_unit_owner(u, queen->owner, true);
@@ -7223,6 +7549,7 @@ struct state_functions {
 			unit_t* fighter = release_fighter(u);
 			if (fighter) {
 				fighter->shield_points = fp8::integer(fighter->unit_type->shield_points);
+				update_unit_sync_hash(fighter);
 				fighter->sprite->elevation_level = u->sprite->elevation_level - 1;
 				set_unit_order(fighter, fighter->unit_type->attack_unit, u->order_target.unit);
 				u->main_order_timer = 7;
@@ -7385,6 +7712,7 @@ struct state_functions {
 			}
 			u->energy -= fp8::integer(tech->energy_cost);
 			u->shield_points = 0_fp8;
+			update_unit_sync_hash(u);
 			order_done(u);
 			play_sound(1062, target);
 		}
@@ -8987,57 +9315,48 @@ struct state_functions {
 		if (us_hidden(u)) return nullptr;
 		xy movement = ems.position - u->sprite->position;
 
-		auto cmp_u = [&](int a, auto& b) {
-			return a < b.value;
-		};
-		auto cmp_l = [&](auto& a, int b) {
-			return a.value < b;
-		};
-
 		auto new_bb = u->unit_finder_bounding_box;
 		new_bb.from += movement;
 		new_bb.to += movement;
 
 		if (movement.x < 0) {
-			auto& arr = st.unit_finder_x;
-			for (auto i = std::upper_bound(arr.begin(), arr.end(), u->unit_finder_bounding_box.from.x, cmp_u); i != arr.begin();) {
+			auto entries = unit_finder_entries(false, new_bb.from.x, u->unit_finder_bounding_box.from.x + 1, new_bb.from.y, new_bb.to.y);
+			for (auto i = entries.end(); i != entries.begin();) {
 				--i;
-				if (i->value < new_bb.from.x) break;
-				if (i->u->unit_finder_bounding_box.from.y <= new_bb.to.y && i->u->unit_finder_bounding_box.to.y >= new_bb.from.y) {
+				auto& bb = st.unit_finder_bounding_boxes[i->index];
+				if (bb.from.y <= new_bb.to.y && bb.to.y >= new_bb.from.y) {
 					if (unit_can_collide_with(u, i->u) && u_ground_unit(i->u)) {
 						return i->u;
 					}
 				}
 			}
 		} else if (movement.x > 0) {
-			auto& arr = st.unit_finder_x;
-			for (auto i = std::lower_bound(arr.begin(), arr.end(), u->unit_finder_bounding_box.to.x, cmp_l); i != arr.end(); ++i) {
-				if (i->value > new_bb.to.x) break;
-				if (i->u->unit_finder_bounding_box.from.y <= new_bb.to.y && i->u->unit_finder_bounding_box.to.y >= new_bb.from.y) {
-					if (unit_can_collide_with(u, i->u) && u_ground_unit(i->u)) {
-						return i->u;
+			for (auto& v : unit_finder_entries(false, u->unit_finder_bounding_box.to.x, new_bb.to.x + 1, new_bb.from.y, new_bb.to.y)) {
+				auto& bb = st.unit_finder_bounding_boxes[v.index];
+				if (bb.from.y <= new_bb.to.y && bb.to.y >= new_bb.from.y) {
+					if (unit_can_collide_with(u, v.u) && u_ground_unit(v.u)) {
+						return v.u;
 					}
 				}
 			}
 		}
 		if (movement.y < 0) {
-			auto& arr = st.unit_finder_y;
-			for (auto i = std::upper_bound(arr.begin(), arr.end(), u->unit_finder_bounding_box.from.y, cmp_u); i != arr.begin();) {
+			auto entries = unit_finder_entries(true, new_bb.from.y, u->unit_finder_bounding_box.from.y + 1, new_bb.from.x, new_bb.to.x);
+			for (auto i = entries.end(); i != entries.begin();) {
 				--i;
-				if (i->value < new_bb.from.y) break;
-				if (i->u->unit_finder_bounding_box.from.x <= new_bb.to.x && i->u->unit_finder_bounding_box.to.x >= new_bb.from.x) {
+				auto& bb = st.unit_finder_bounding_boxes[i->index];
+				if (bb.from.x <= new_bb.to.x && bb.to.x >= new_bb.from.x) {
 					if (unit_can_collide_with(u, i->u) && u_ground_unit(i->u)) {
 						return i->u;
 					}
 				}
 			}
 		} else if (movement.y > 0) {
-			auto& arr = st.unit_finder_y;
-			for (auto i = std::lower_bound(arr.begin(), arr.end(), u->unit_finder_bounding_box.to.y, cmp_l); i != arr.end(); ++i) {
-				if (i->value > new_bb.to.y) break;
-				if (i->u->unit_finder_bounding_box.from.x <= new_bb.to.x && i->u->unit_finder_bounding_box.to.x >= new_bb.from.x) {
-					if (unit_can_collide_with(u, i->u) && u_ground_unit(i->u)) {
-						return i->u;
+			for (auto& v : unit_finder_entries(true, u->unit_finder_bounding_box.to.y, new_bb.to.y + 1, new_bb.from.x, new_bb.to.x)) {
+				auto& bb = st.unit_finder_bounding_boxes[v.index];
+				if (bb.from.x <= new_bb.to.x && bb.to.x >= new_bb.from.x) {
+					if (unit_can_collide_with(u, v.u) && u_ground_unit(v.u)) {
+						return v.u;
 					}
 				}
 			}
@@ -9135,7 +9454,9 @@ struct state_functions {
 
 	bool finish_unit_movement(unit_t* u, execute_movement_struct& ems) {
 		auto prev_pos = u->position;
-		if (!finish_flingy_movement(u, ems)) return false;
+		bool moved = finish_flingy_movement(u, ems);
+		update_unit_sync_hash(u);
+		if (!moved) return false;
 		if (tile_index(prev_pos) != tile_index(u->position)) ems.refresh_vision = true;
 		unit_finder_reinsert(u);
 		return true;
@@ -9188,23 +9509,21 @@ struct state_functions {
 	bool pathfinder_find_long_path(pathfinder& pf) const {
 		if (pf.source_region == pf.destination_region) return false;
 
-		struct node_t {
-			node_t* prev = nullptr;
-			xy_fp8 pos;
-			const regions_t::region* region = nullptr;
-			fp8 total_cost{};
-			fp8 estimated_remaining_cost{};
-			fp8 estimated_final_cost{};
-			bool visited = false;
-		};
+		using node_t = pathfinder_long_path_node;
 		struct cmp_node {
 			bool operator()(const node_t* a, const node_t* b) const {
 				return a->estimated_final_cost < b->estimated_final_cost;
 			}
 		};
-		a_vector<node_t*> open;
+		auto& open = pathfinder_scratch.long_path_open;
+
+		// Nodes are referenced by pointer, so all_nodes must never reallocate;
+		// it holds at most 350 nodes.
+		auto& all_nodes = pathfinder_scratch.long_path_nodes;
+		all_nodes.reserve(350);
 
-		a_list<node_t> all_nodes;
+		auto& region_nodes = pathfinder_scratch.region_nodes;
+		if (region_nodes.size() != game_st.regions.regions.size()) region_nodes.assign(game_st.regions.regions.size(), nullptr);
 
 		node_t* goal_node = nullptr;
 
@@ -9227,7 +9546,7 @@ struct state_functions {
 			start_node->region = from_region;
 			start_node->estimated_remaining_cost = fp8::integer(128 * 128);
 			start_node->estimated_final_cost = start_node->estimated_remaining_cost;
-			start_node->region->pathfinder_node = (void*)start_node;
+			region_nodes[start_node->region->index] = start_node;
 
 			open.push_back(start_node);
 			binary_heap_up(std::prev(open.end()), open.begin(), open.end(), cmp_node());
@@ -9253,7 +9572,7 @@ struct state_functions {
 						cost *= 2;
 					}
 					fp8 total_cost = cur->total_cost + cost;
-					node_t* n = (node_t*)r->pathfinder_node;
+					node_t* n = region_nodes[r->index];
 					if (!n) {
 						all_nodes.emplace_back();
 						n = &all_nodes.back();
@@ -9264,7 +9583,7 @@ struct state_functions {
 						n->estimated_remaining_cost = xy_length(to_pos - pos);
 						n->estimated_final_cost = n->total_cost + n->estimated_remaining_cost;
 						n->visited = false;
-						r->pathfinder_node = (void*)n;
+						region_nodes[r->index] = n;
 						open.push_back(n);
 						binary_heap_up(std::prev(open.end()), open.begin(), open.end(), cmp_node());
 					} else if (cur->prev != n) {
@@ -9328,7 +9647,7 @@ struct state_functions {
 			path_is_reversed = true;
 			if (goal_node->region != pf.source_region) {
 				for (auto& v : all_nodes) {
-					v.region->pathfinder_node = nullptr;
+					region_nodes[v.region->index] = nullptr;
 				}
 				find(pf.source_region, goal_node->region);
 				path_is_reversed = false;
@@ -9361,7 +9680,7 @@ struct state_functions {
 		}
 		pf.full_long_path_size = full_path_size;
 		for (auto& v : all_nodes) {
-			v.region->pathfinder_node = nullptr;
+			region_nodes[v.region->index] = nullptr;
 		}
 		return !pf.long_path.empty();
 	}
@@ -9423,9 +9742,11 @@ struct state_functions {
 
 		const regions_t::region* move_to_region = target_region ? target_region : destination_region;
 
+		auto& region_flags = pathfinder_scratch.region_flags;
+		if (region_flags.size() != game_st.regions.regions.size()) region_flags.assign(game_st.regions.regions.size(), 0);
 		for (auto* nr : move_to_region->walkable_neighbors) {
 			if (nr == source_region) continue;
-			nr->pathfinder_flag = 1;
+			region_flags[nr->index] = 1;
 		}
 
 		struct pf_search {
@@ -9441,7 +9762,7 @@ struct state_functions {
 			xy cur_pos_max;
 			xy cur_pos_min;
 
-			std::array<a_vector<regions_t::contour>, 4> local_edges;
+			std::array<a_vector<regions_t::contour>, 4>& local_edges;
 
 			std::array<const regions_t::contour*, 4> nearest_edge;
 
@@ -9452,10 +9773,12 @@ struct state_functions {
 			};
 			static_vector<neighbor_t, 32> neighbors;
 
-			a_vector<rect> visited_areas;
+			a_vector<rect>& visited_areas;
+
+			pf_search(std::array<a_vector<regions_t::contour>, 4>& local_edges, a_vector<rect>& visited_areas) : local_edges(local_edges), visited_areas(visited_areas) {}
 		};
 
-		pf_search w;
+		pf_search w(pathfinder_scratch.local_edges, pathfinder_scratch.visited_areas);
 
 		w.u = pf.u;
 		w.target_unit = pf.target_unit;
@@ -9505,10 +9828,10 @@ struct state_functions {
 
 		struct visited {
 			int x;
-			a_vector<std::pair<int, int>> y;
+			static_vector<std::pair<int, int>, 10> y;
 		};
 
-		a_vector<visited> pf_area_visited;
+		static_vector<visited, 128 + 1> pf_area_visited;
 		pf_area_visited.push_back({0, {}});
 		pf_area_visited.push_back({(int)game_st.map_width, {}});
 
@@ -9642,13 +9965,9 @@ struct state_functions {
 		};
 
 		auto pf_add_local_units = [&]() {
-			auto cmp_l = [&](auto& a, int b) {
-				return a.value < b;
-			};
-			for (auto i = std::lower_bound(st.unit_finder_y.begin(), st.unit_finder_y.end(), w.cur_pos_min.y - w.inner[0] - 1, cmp_l); i != st.unit_finder_y.end(); ++i) {
-				auto& bb = i->u->unit_finder_bounding_box;
-				if (i->value >= w.cur_pos.y - w.inner[0]) break;
-				if (i->value == bb.to.y) {
+			for (auto& v : unit_finder_entries(true, w.cur_pos_min.y - w.inner[0] - 1, w.cur_pos.y - w.inner[0], w.cur_pos_min.x - w.inner[3], w.cur_pos_max.x - w.inner[1])) {
+				auto& bb = st.unit_finder_bounding_boxes[v.index];
+				if (v.value == bb.to.y) {
 					regions_t::contour c;
 					c.v[0] = bb.to.y;
 					c.v[1] = bb.from.x;
@@ -9656,16 +9975,15 @@ struct state_functions {
 					c.dir = 0;
 					c.flags = 0x3d;
 					if (c.v[1] + w.inner[1] <= w.cur_pos_max.x && c.v[2] + w.inner[3] >= w.cur_pos_min.x) {
-						if (i->u == w.target_unit || pathfinder_unit_can_collide_with(pf, i->u)) {
+						if (v.u == w.target_unit || pathfinder_unit_can_collide_with(pf, v.u)) {
 							pf_add_local_edge(0, c);
 						}
 					}
 				}
 			}
-			for (auto i = std::lower_bound(st.unit_finder_x.begin(), st.unit_finder_x.end(), w.cur_pos.x - w.inner[1], cmp_l); i != st.unit_finder_x.end(); ++i) {
-				auto& bb = i->u->unit_finder_bounding_box;
-				if (i->value > w.cur_pos_max.x - w.inner[1] + 1) break;
-				if (i->value == bb.from.x) {
+			for (auto& v : unit_finder_entries(false, w.cur_pos.x - w.inner[1], w.cur_pos_max.x - w.inner[1] + 2, w.cur_pos_min.y - w.inner[0], w.cur_pos_max.y - w.inner[2])) {
+				auto& bb = st.unit_finder_bounding_boxes[v.index];
+				if (v.value == bb.from.x) {
 					regions_t::contour c;
 					c.v[0] = bb.from.x;
 					c.v[1] = bb.from.y;
@@ -9673,16 +9991,15 @@ struct state_functions {
 					c.dir = 1;
 					c.flags = 0x32;
 					if (c.v[1] + w.inner[2] <= w.cur_pos_max.y && c.v[2] + w.inner[0] >= w.cur_pos_min.y) {
-						if (i->u == w.target_unit || pathfinder_unit_can_collide_with(pf, i->u)) {
+						if (v.u == w.target_unit || pathfinder_unit_can_collide_with(pf, v.u)) {
 							pf_add_local_edge(1, c);
 						}
 					}
 				}
 			}
-			for (auto i = std::lower_bound(st.unit_finder_y.begin(), st.unit_finder_y.end(), w.cur_pos.y - w.inner[2], cmp_l); i != st.unit_finder_y.end(); ++i) {
-				auto& bb = i->u->unit_finder_bounding_box;
-				if (i->value > w.cur_pos_max.y - w.inner[2] + 1) break;
-				if (i->value == bb.from.y) {
+			for (auto& v : unit_finder_entries(true, w.cur_pos.y - w.inner[2], w.cur_pos_max.y - w.inner[2] + 2, w.cur_pos_min.x - w.inner[3], w.cur_pos_max.x - w.inner[1])) {
+				auto& bb = st.unit_finder_bounding_boxes[v.index];
+				if (v.value == bb.from.y) {
 					regions_t::contour c;
 					c.v[0] = bb.from.y;
 					c.v[1] = bb.from.x;
@@ -9690,16 +10007,15 @@ struct state_functions {
 					c.dir = 2;
 					c.flags = 0x3d;
 					if (c.v[1] + w.inner[1] <= w.cur_pos_max.x && c.v[2] + w.inner[3] >= w.cur_pos_min.x) {
-						if (i->u == w.target_unit || pathfinder_unit_can_collide_with(pf, i->u)) {
+						if (v.u == w.target_unit || pathfinder_unit_can_collide_with(pf, v.u)) {
 							pf_add_local_edge(2, c);
 						}
 					}
 				}
 			}
-			for (auto i = std::lower_bound(st.unit_finder_x.begin(), st.unit_finder_x.end(), w.cur_pos_min.x - w.inner[3] - 1, cmp_l); i != st.unit_finder_x.end(); ++i) {
-				auto& bb = i->u->unit_finder_bounding_box;
-				if (i->value >= w.cur_pos.x - w.inner[3]) break;
-				if (i->value == bb.to.x) {
+			for (auto& v : unit_finder_entries(false, w.cur_pos_min.x - w.inner[3] - 1, w.cur_pos.x - w.inner[3], w.cur_pos_min.y - w.inner[0], w.cur_pos_max.y - w.inner[2])) {
+				auto& bb = st.unit_finder_bounding_boxes[v.index];
+				if (v.value == bb.to.x) {
 					regions_t::contour c;
 					c.v[0] = bb.to.x;
 					c.v[1] = bb.from.y;
@@ -9707,7 +10023,7 @@ struct state_functions {
 					c.dir = 3;
 					c.flags = 0x32;
 					if (c.v[1] + w.inner[2] <= w.cur_pos_max.y && c.v[2] + w.inner[0] >= w.cur_pos_min.y) {
-						if (i->u == w.target_unit || pathfinder_unit_can_collide_with(pf, i->u)) {
+						if (v.u == w.target_unit || pathfinder_unit_can_collide_with(pf, v.u)) {
 							pf_add_local_edge(3, c);
 						}
 					}
@@ -10420,7 +10736,7 @@ struct state_functions {
 					n->estimated_final_cost = n->total_cost + n->estimated_remaining_cost;
 					n->visited = n->directional_flags == 0 && !n->is_goal;
 					n->is_target_region = n->region == target_region;
-					n->is_neighbor_region = n->region->pathfinder_flag != 0;
+					n->is_neighbor_region = region_flags[n->region->index] != 0;
 					n->is_goal = v.is_goal;
 					if (!n->visited) {
 						open.push_back(n);
@@ -10469,7 +10785,7 @@ struct state_functions {
 			int n_unvisited_destination_region_nodes = 0;
 
 			for (auto i = std::next(all_nodes.begin()); i != all_nodes.end(); ++i) {
-				if (i->region->pathfinder_flag) ++i->region->pathfinder_flag;
+				if (region_flags[i->region->index]) ++region_flags[i->region->index];
 				if (!i->visited) {
 					if (i->directional_flags) i->directional_flags = pf_remove_visited_flags(i->pos, i->directional_flags);
 					if (i->directional_flags) {
@@ -10486,11 +10802,11 @@ struct state_functions {
 				n_unvisited_nodes = n_unvisited_destination_region_nodes;
 				for (auto* nr : move_to_region->walkable_neighbors) {
 					if (nr == source_region) continue;
-					if (nr->pathfinder_flag < 2) {
+					if (region_flags[nr->index] < 2) {
 						++n_unvisited_nodes;
 						break;
 					} else {
-						n_unvisited_nodes -= nr->pathfinder_flag / 2;
+						n_unvisited_nodes -= region_flags[nr->index] / 2;
 						if (n_unvisited_nodes < 0) n_unvisited_nodes = 0;
 					}
 				}
@@ -10520,7 +10836,7 @@ struct state_functions {
 					if (i->region == destination_region || i->region == target_region) {
 						cost += i->total_cost / 2;
 					} else {
-						if (i->region->pathfinder_flag) {
+						if (region_flags[i->region->index]) {
 							cost = cost * 3 / 2;
 						} else {
 							if (i->region == source_region) cost *= 2;
@@ -10550,7 +10866,7 @@ struct state_functions {
 		}
 		for (auto* nr : move_to_region->walkable_neighbors) {
 			if (nr == source_region) continue;
-			nr->pathfinder_flag = 0;
+			region_flags[nr->index] = 0;
 		}
 	}
 
@@ -10703,6 +11019,7 @@ struct state_functions {
 	}
 
 	bool pathfinder_find_long_path(pathfinder& pf, xy from, xy to) const {
+		BWGAME_PROFILE_COUNT(counter_pathfinder_calls, 1);
 		pf.source = from;
 		pf.destination = to;
 		pf.source_region = get_region_at(pf.source);
@@ -10721,6 +11038,48 @@ struct state_functions {
 		}
 	}
 
+	// Finds the long path of every pathfinder in pfs from its source to its
+	// destination, as pathfinder_find_long_path does, but searches only once
+	// for pathfinders with the same source and destination. With
+	// share_by_region, it searches once per pair of source and destination
+	// regions instead, which is far cheaper for a group of units moving
+	// together. The long paths found that way are valid but may differ from
+	// what pathfinder_find_long_path gives each unit, since the search costs
+	// depend on the exact source and destination positions, so the simulation
+	// must not use it.
+	// Returns the number of searches done.
+	size_t pathfinder_find_long_paths(a_vector<pathfinder>& pfs, bool share_by_region = false) const {
+		a_map<std::array<int, 4>, size_t> found;
+		size_t searches = 0;
+		for (size_t i = 0; i != pfs.size(); ++i) {
+			auto& pf = pfs[i];
+			std::array<int, 4> key;
+			if (share_by_region) {
+				key = {(int)get_region_at(pf.source)->index, (int)get_region_at(pf.destination)->index, 0, 0};
+			} else {
+				key = {pf.source.x, pf.source.y, pf.destination.x, pf.destination.y};
+			}
+			auto it = found.find(key);
+			if (it == found.end()) {
+				pathfinder_find_long_path(pf, pf.source, pf.destination);
+				found.emplace(key, i);
+				++searches;
+				continue;
+			}
+			auto& r = pfs[it->second];
+			pf.source_region = r.source_region;
+			pf.destination_region = r.destination_region;
+			pf.long_path = r.long_path;
+			pf.full_long_path_size = r.full_long_path_size;
+			pf.current_long_path_index = r.current_long_path_index;
+			pf.long_all_nodes_size = r.long_all_nodes_size;
+			pf.long_highest_open_size = r.long_highest_open_size;
+			pf.destination_reached = r.destination_reached;
+			pf.is_stuck = r.is_stuck;
+		}
+		return searches;
+	}
+
 	bool pathfinder_find(pathfinder& pf, bool short_path_only = false) {
 		pf.source_region = get_region_at(pf.source);
 		pf.destination_region = get_region_at(pf.destination);
@@ -10882,6 +11241,199 @@ struct state_functions {
 		return path;
 	}
 
+	static constexpr uint8_t flow_field_destination = 8;
+	static constexpr uint8_t flow_field_unreachable = 0xff;
+
+	bool flow_field_tile_walkable(size_t tile_x, size_t tile_y) const {
+		size_t index = game_st.regions.tile_region_index[tile_y * 256 + tile_x];
+		if (index < 5000) return game_st.regions.regions[index].walkable();
+		if (index >= 0x2000) {
+			auto& split = game_st.regions.split_regions[index - 0x2000];
+			return split.a->walkable() || split.b->walkable();
+		}
+		return index != 0x1ffd;
+	}
+
+	// Straight directions first, then diagonals.
+	xy flow_field_offset(size_t dir) const {
+		static const std::array<xy, 8> offsets = {xy(0, -1), xy(1, 0), xy(0, 1), xy(-1, 0), xy(1, -1), xy(1, 1), xy(-1, 1), xy(-1, -1)};
+		return offsets[dir];
+	}
+
+	// For every tile, the direction (see flow_field_offset) of the
+	// next tile on a shortest path over walkable tiles to the tile containing
+	// destination, flow_field_destination for that tile itself, or
+	// flow_field_unreachable. Diagonal steps are only taken between two
+	// walkable tiles. The fields only depend on the map, so they ignore
+	// buildings, and are cached in regions_t::flow_field_cache.
+	std::shared_ptr<const a_vector<uint8_t>> flow_field_to(xy destination) const {
+		auto& cache = game_st.regions.flow_field_cache;
+		size_t destination_index = tile_index(destination);
+		{
+			std::lock_guard<std::mutex> l(cache.mut);
+			if (cache.generation != game_st.regions.generation) {
+				cache.fields.clear();
+				cache.generation = game_st.regions.generation;
+			}
+			for (auto i = cache.fields.begin(); i != cache.fields.end(); ++i) {
+				if (i->first != destination_index) continue;
+				if (std::next(i) != cache.fields.end()) std::rotate(i, std::next(i), cache.fields.end());
+				return cache.fields.back().second;
+			}
+		}
+
+		size_t width = game_st.map_tile_width;
+		size_t height = game_st.map_tile_height;
+		auto walkable = [&](xy tile) {
+			if ((size_t)tile.x >= width || (size_t)tile.y >= height) return false;
+			return flow_field_tile_walkable(tile.x, tile.y);
+		};
+		// Diagonal steps cost 14 and straight steps 10.
+		auto step_cost = [&](xy tile, size_t dir) {
+			xy offset = flow_field_offset(dir);
+			if (!walkable(tile + offset)) return -1;
+			if (dir < 4) return 10;
+			if (!walkable(tile + xy(offset.x, 0)) || !walkable(tile + xy(0, offset.y))) return -1;
+			return 14;
+		};
+		auto& costs = flow_field_scratch.costs;
+		auto& open = flow_field_scratch.open;
+		costs.assign(width * height, std::numeric_limits<int>::max());
+		open.clear();
+		auto cmp = [](auto& a, auto& b) {
+			return a.first > b.first;
+		};
+		xy destination_tile(destination.x / 32, destination.y / 32);
+		if (walkable(destination_tile)) {
+			costs[destination_index] = 0;
+			open.emplace_back(0, destination_index);
+		}
+		while (!open.empty()) {
+			std::pop_heap(open.begin(), open.end(), cmp);
+			auto cur = open.back();
+			open.pop_back();
+			if (cur.first != costs[cur.second]) continue;
+			xy tile((int)(cur.second % width), (int)(cur.second / width));
+			for (size_t dir = 0; dir != 8; ++dir) {
+				int cost = step_cost(tile, dir);
+				if (cost < 0) continue;
+				xy n = tile + flow_field_offset(dir);
+				size_t index = n.y * width + n.x;
+				if (cur.first + cost < costs[index]) {
+					costs[index] = cur.first + cost;
+					open.emplace_back(costs[index], index);
+					std::push_heap(open.begin(), open.end(), cmp);
+				}
+			}
+		}
+
+		auto r = std::make_shared<a_vector<uint8_t>>(width * height, flow_field_unreachable);
+		auto& field = *r;
+		for (size_t index = 0; index != field.size(); ++index) {
+			if (costs[index] == std::numeric_limits<int>::max()) continue;
+			if (index == destination_index) {
+				field[index] = flow_field_destination;
+				continue;
+			}
+			xy tile((int)(index % width), (int)(index / width));
+			int best_cost = std::numeric_limits<int>::max();
+			for (size_t dir = 0; dir != 8; ++dir) {
+				int cost = step_cost(tile, dir);
+				if (cost < 0) continue;
+				xy n = tile + flow_field_offset(dir);
+				int n_cost = costs[n.y * width + n.x];
+				if (n_cost == std::numeric_limits<int>::max()) continue;
+				if (n_cost + cost < best_cost) {
+					best_cost = n_cost + cost;
+					field[index] = (uint8_t)dir;
+				}
+			}
+		}
+
+		// Another thread may have computed the same field in the meantime; it
+		// is identical, so either can be kept.
+		std::lock_guard<std::mutex> l(cache.mut);
+		if (cache.generation != game_st.regions.generation) return r;
+		for (auto& v : cache.fields) {
+			if (v.first == destination_index) return v.second;
+		}
+		if (cache.fields.size() >= cache.max_fields) cache.fields.erase(cache.fields.begin());
+		cache.fields.emplace_back(destination_index, r);
+		return r;
+	}
+
+	// Whether the step in direction dir from tile crosses a tile occupied by
+	// a building, which the flow fields do not know about.
+	bool flow_field_step_blocked(xy tile, size_t dir) const {
+		size_t width = game_st.map_tile_width;
+		auto occupied = [&](xy t) {
+			return (st.tiles[t.y * width + t.x].flags & tile_t::flag_occupied) != 0;
+		};
+		xy offset = flow_field_offset(dir);
+		if (occupied(tile + offset)) return true;
+		if (dir < 4) return false;
+		return occupied(tile + xy(offset.x, 0)) || occupied(tile + xy(0, offset.y));
+	}
+
+	// The next waypoint from from towards to along the flow field to to: the
+	// center of the last tile of the straight run of tiles from from, up to 8
+	// tiles and ending before any building, or to itself from the tile
+	// containing it. false if from is not on a tile that reaches to, or if a
+	// building occupies the next tile.
+	std::pair<bool, xy> flow_field_next_waypoint(xy from, xy to) const {
+		auto field_ptr = flow_field_to(to);
+		auto& field = *field_ptr;
+		size_t width = game_st.map_tile_width;
+		xy tile(from.x / 32, from.y / 32);
+		uint8_t dir = field[tile_index(from)];
+		if (dir == flow_field_unreachable) return {false, {}};
+		if (dir == flow_field_destination) return {true, to};
+		if (flow_field_step_blocked(tile, dir)) return {false, {}};
+		for (int i = 0; i != 8; ++i) {
+			xy n = tile + flow_field_offset(dir);
+			uint8_t n_dir = field[n.y * width + n.x];
+			if (n_dir == flow_field_destination) return {true, to};
+			tile = n;
+			if (n_dir != dir || flow_field_step_blocked(tile, dir)) break;
+		}
+		return {true, tile * 32 + xy(16, 16)};
+	}
+
+	// Replaces path_progress for ground units when game_st.flow_field_movement
+	// is set. u->path holds just the next waypoint. Falls back to
+	// path_progress where the flow field has no path or a building is in the
+	// way, and when repathing around a collision, since the flow fields do not
+	// know about units.
+	bool flow_field_path_progress(unit_t* u, xy to, const unit_t* consider_collision_with_unit, bool consider_collision_with_moving_units) {
+		if (consider_collision_with_unit || consider_collision_with_moving_units) {
+			return path_progress(u, to, consider_collision_with_unit, consider_collision_with_moving_units);
+		}
+		auto next = flow_field_next_waypoint(u->sprite->position, to);
+		if (!next.first) return path_progress(u, to, consider_collision_with_unit, consider_collision_with_moving_units);
+		u_unset_movement_flag(u, 0x40);
+		u_set_movement_flag(u, 0x10);
+		path_t* path = u->path;
+		if (!path) {
+			path = new_path();
+			if (!path) return false;
+			path->delay = 0;
+			path->creation_frame = st.current_frame;
+			path->state_flags = 0;
+			u->path = path;
+		}
+		path->long_path = {get_region_at(to)};
+		path->full_long_path_size = 1;
+		path->current_long_path_index = 0;
+		path->short_path = {next.second};
+		path->current_short_path_index = 0;
+		path->source = u->sprite->position;
+		path->destination = to;
+		path->next = next.second;
+		if (path->next == u->move_target.pos) u_unset_movement_flag(u, 0x10);
+		else if (xy_length(path->destination - path->next) < 16) u_set_movement_flag(u, 0x40);
+		return true;
+	}
+
 	bool unit_path_to(unit_t* u, xy to, const unit_t* consider_collision_with_unit = nullptr, bool consider_collision_with_moving_units = false) {
 		if (is_moving_along_path(u)) return true;
 		if (!u_ground_unit(u)) {
@@ -10891,7 +11443,11 @@ struct state_functions {
 			if (!u->path) return false;
 			return true;
 		}
-		if (!path_progress(u, to, consider_collision_with_unit, consider_collision_with_moving_units)) return false;
+		if (game_st.flow_field_movement) {
+			if (!flow_field_path_progress(u, to, consider_collision_with_unit, consider_collision_with_moving_units)) return false;
+		} else {
+			if (!path_progress(u, to, consider_collision_with_unit, consider_collision_with_moving_units)) return false;
+		}
 		set_next_target_waypoint(u, u->path->next);
 		if (u->next_movement_waypoint != u->path->next) {
 			u->next_movement_waypoint = u->path->next;
@@ -12303,48 +12859,105 @@ struct state_functions {
 		return 0;
 	}
 
-	void reveal_sight_at(xy pos, int range, int reveal_to, bool in_air) {
-		int visibility_mask = ~reveal_to;
-		int height_mask = 0;
-		if (!in_air) {
-			int height = get_ground_height_at(pos);
-			if (height == 2) height_mask = tile_t::flag_very_high;
-			else if (height == 1) height_mask = tile_t::flag_very_high | tile_t::flag_high;
-			else height_mask = tile_t::flag_very_high | tile_t::flag_high | tile_t::flag_middle;
+	// Sets visible to 0xff in every tile, 4 tiles at a time where SIMD is
+	// available.
+	void reset_tiles_visibility() {
+		static_assert(sizeof(tile_t) == 4 && offsetof(tile_t, visible) == 0, "reset_tiles_visibility depends on the layout of tile_t");
+		uint8_t* p = (uint8_t*)st.tiles.data();
+		size_t n = st.tiles.size();
+		size_t i = 0;
+#if defined(BWGAME_SIMD_SSE2)
+		const __m128i mask = _mm_set1_epi32(0xff);
+		for (; i + 4 <= n; i += 4) {
+			__m128i* v = (__m128i*)(p + i * 4);
+			_mm_storeu_si128(v, _mm_or_si128(_mm_loadu_si128(v), mask));
+		}
+#elif defined(BWGAME_SIMD_NEON)
+		const uint8x16_t mask = vreinterpretq_u8_u32(vdupq_n_u32(0xff));
+		for (; i + 4 <= n; i += 4) {
+			vst1q_u8(p + i * 4, vorrq_u8(vld1q_u8(p + i * 4), mask));
+		}
+#elif defined(BWGAME_SIMD_WASM)
+		const v128_t mask = wasm_i32x4_splat(0xff);
+		for (; i + 4 <= n; i += 4) {
+			wasm_v128_store(p + i * 4, wasm_v128_or(wasm_v128_load(p + i * 4), mask));
+		}
+#endif
+		for (; i != n; ++i) {
+			st.tiles[i].visible = 0xff;
+		}
+	}
+
+	// Returns true if an identical call to reveal_sight_at was already made
+	// since the visibility reset of this frame, and records the call otherwise.
+	// reveal_sight_at only clears bits, so repeating a call changes nothing;
+	// this skips the repeats for units stacked on the same tile.
+	bool sight_reveal_seen(size_t tile_index, int range, int reveal_to, int height_mask) const {
+		auto& set = sight_reveal_set;
+		if (!set.active) return false;
+		uint64_t key = (uint64_t)tile_index << 32 | (uint64_t)range << 24 | (uint64_t)(uint8_t)reveal_to << 16 | (uint64_t)height_mask;
+		size_t mask = set.entries.size() - 1;
+		size_t index = (size_t)((key * 0x9e3779b97f4a7c15ull) >> 40) & mask;
+		while (set.entries[index].stamp == set.stamp) {
+			if (set.entries[index].key == key) return true;
+			index = (index + 1) & mask;
+		}
+		if (set.size >= set.entries.size() / 2) return false;
+		set.entries[index] = {key, set.stamp};
+		++set.size;
+		return false;
+	}
+
+	void begin_sight_reveal_set() {
+		auto& set = sight_reveal_set;
+		if (set.entries.empty()) set.entries.resize(set.capacity);
+		if (++set.stamp == 0) {
+			std::fill(set.entries.begin(), set.entries.end(), sight_reveal_set_t::entry{});
+			set.stamp = 1;
 		}
+		set.size = 0;
+		set.active = true;
+	}
+
+	void end_sight_reveal_set() {
+		sight_reveal_set.active = false;
+	}
+
+	// The tiles that reveal_sight_at reveals, as indices into st.tiles, given
+	// the height mask of the revealing position (0 in the air). They only
+	// depend on the terrain: a revealed tile has the bits of the revealing
+	// players cleared in visible and explored, so only its height flags decide
+	// whether sight propagates through it.
+	void sight_tiles(size_t tile_x, size_t tile_y, int range, bool in_air, int height_mask, a_vector<uint32_t>& r) const {
 		const size_t max_width = 11 * 2 + 3;
-		std::array<uint32_t, max_width * max_width> vision_propagation;
-		uint32_t required_tile_mask = (uint32_t)height_mask << 16 | (uint32_t)(uint8_t)~visibility_mask << 8 | (uint32_t)(uint8_t)~visibility_mask;
+		std::array<bool, max_width * max_width> opaque;
 		const auto& sight_vals = game_st.sight_values.at(range);
-		size_t tile_x = (size_t)pos.x / 32;
-		size_t tile_y = (size_t)pos.y / 32;
-		tile_t* base_tile = &st.tiles[tile_x + tile_y*game_st.map_tile_width];
+		size_t base_index = tile_x + tile_y * game_st.map_tile_width;
+		r.clear();
 		if (!in_air) {
 			size_t index = 0;
 			size_t end = sight_vals.min_mask_size;
 			for (; index != end; ++index) {
 				const auto& cur = sight_vals.maskdat[index];
-				vision_propagation[index] = 0xff;
+				opaque[index] = true;
 				if (tile_x + cur.x >= game_st.map_tile_width) continue;
 				if (tile_y + cur.y >= game_st.map_tile_height) continue;
-				auto& tile = base_tile[cur.relative_tile_index];
-				tile.visible &= visibility_mask;
-				tile.explored &= visibility_mask;
-				vision_propagation[index] = (uint32_t)tile.flags << 16 | (uint32_t)tile.explored << 8 | (uint32_t)tile.visible;
+				size_t tile_index = base_index + cur.relative_tile_index;
+				r.push_back((uint32_t)tile_index);
+				opaque[index] = (st.tiles[tile_index].flags & height_mask) != 0;
 			}
 			end += sight_vals.ext_masked_count;
 			for (; index != end; ++index) {
 				const auto& cur = sight_vals.maskdat[index];
-				vision_propagation[index] = 0xff;
+				opaque[index] = true;
 				if (tile_x + cur.x >= game_st.map_tile_width) continue;
 				if (tile_y + cur.y >= game_st.map_tile_height) continue;
-				if (vision_propagation[cur.prev] & required_tile_mask) {
-					if (cur.prev2 == (size_t)~0 || (vision_propagation[cur.prev2] & required_tile_mask)) continue;
+				if (opaque[cur.prev]) {
+					if (cur.prev2 == (size_t)~0 || opaque[cur.prev2]) continue;
 				}
-				auto& tile = base_tile[cur.relative_tile_index];
-				tile.visible &= visibility_mask;
-				tile.explored &= visibility_mask;
-				vision_propagation[index] = (uint32_t)tile.flags << 16 | (uint32_t)tile.explored << 8 | (uint32_t)tile.visible;
+				size_t tile_index = base_index + cur.relative_tile_index;
+				r.push_back((uint32_t)tile_index);
+				opaque[index] = (st.tiles[tile_index].flags & height_mask) != 0;
 			}
 		} else {
 			// This seems bugged; even for air units, if you only traverse ext_masked_count nodes,
@@ -12354,29 +12967,90 @@ struct state_functions {
 			for (; cur != end; ++cur) {
 				if (tile_x + cur->x >= game_st.map_tile_width) continue;
 				if (tile_y + cur->y >= game_st.map_tile_height) continue;
-				auto& tile = base_tile[cur->relative_tile_index];
-				tile.visible &= visibility_mask;
-				tile.explored &= visibility_mask;
+				r.push_back((uint32_t)(base_index + cur->relative_tile_index));
 			}
 		}
 	}
 
+	int sight_height_mask(xy pos, bool in_air) const {
+		if (in_air) return 0;
+		int height = get_ground_height_at(pos);
+		if (height == 2) return tile_t::flag_very_high;
+		else if (height == 1) return tile_t::flag_very_high | tile_t::flag_high;
+		else return tile_t::flag_very_high | tile_t::flag_high | tile_t::flag_middle;
+	}
+
+	// sight_tiles, from sight_tiles_cache when cache_sight_tiles is set.
+	const a_vector<uint32_t>& get_sight_tiles(xy pos, int range, bool in_air, int height_mask) const {
+		size_t tile_x = (size_t)pos.x / 32;
+		size_t tile_y = (size_t)pos.y / 32;
+		auto& cache = sight_tiles_cache;
+		if (!cache_sight_tiles) {
+			sight_tiles(tile_x, tile_y, range, in_air, height_mask, cache.scratch);
+			return cache.scratch;
+		}
+		if (cache.generation != game_st.regions.generation) {
+			cache.tiles.clear();
+			cache.generation = game_st.regions.generation;
+		}
+		uint64_t key = (uint64_t)tile_index(pos) << 32 | (uint64_t)range << 24 | (in_air ? 0xffff : (uint64_t)height_mask);
+		auto i = cache.tiles.find(key);
+		if (i != cache.tiles.end()) return i->second;
+		if (cache.tiles.size() >= cache.max_entries) cache.tiles.clear();
+		auto& r = cache.tiles[key];
+		sight_tiles(tile_x, tile_y, range, in_air, height_mask, r);
+		return r;
+	}
+
+	void reveal_sight_at(xy pos, int range, int reveal_to, bool in_air) {
+		if ((uint8_t)reveal_to == 0) return;
+		uint8_t visibility_mask = (uint8_t)~reveal_to;
+		int height_mask = sight_height_mask(pos, in_air);
+		if (sight_reveal_seen(tile_index(pos), range, reveal_to, in_air ? 0xffff : height_mask)) return;
+		for (uint32_t index : get_sight_tiles(pos, range, in_air, height_mask)) {
+			auto& tile = st.tiles[index];
+			tile.visible &= visibility_mask;
+			tile.explored &= visibility_mask;
+		}
+	}
+
+	int unit_sight_reveal_to(const unit_t* u) const {
+		if (visible_to_everyone(u) || (unit_is(u, UnitTypes::Powerup_Flag) && u->order_type->id == Orders::UnusedPowerup)) return 0xff;
+		int visible_to = st.shared_vision[u->owner] | u->parasite_flags;
+		if (u->parasite_flags) {
+			visible_to |= u->parasite_flags;
+			for (size_t i = 0; i != 12; ++i) {
+				if (~u->parasite_flags&(1 << i)) continue;
+				visible_to |= st.shared_vision[i];
+			}
+		}
+		return visible_to;
+	}
+
+	// Spreads the work of the visibility refresh every 100 frames over the
+	// frames in between when cache_sight_tiles is set: on every other frame,
+	// about 1/99th of the units have their sight tiles computed ahead, so
+	// that at the refresh only units that have since moved to another tile
+	// or changed sight range need theirs computed.
+	void prepare_sight_tiles() const {
+		if (!cache_sight_tiles || update_tiles) return;
+		size_t slot = (size_t)st.update_tiles_countdown % 99;
+		auto prepare = [&](const unit_t* u) {
+			if (u->index % 99 != slot || !u->sprite) return;
+			if (u->owner >= 8 && !u->parasite_flags) return;
+			if (unit_is(u, UnitTypes::Terran_Nuclear_Missile)) return;
+			xy pos = u->sprite->position;
+			bool in_air = u_flying(u);
+			get_sight_tiles(pos, unit_sight_range(u) / 32u, in_air, sight_height_mask(pos, in_air));
+		};
+		for (const unit_t* u : ptr(st.visible_units)) prepare(u);
+		for (const unit_t* u : ptr(st.map_revealer_units)) prepare(u);
+	}
+
 	void refresh_unit_vision(unit_t* u) {
 		if (u->owner >= 8 && !u->parasite_flags) return;
 		if (unit_is(u, UnitTypes::Terran_Nuclear_Missile)) return;
-		int visible_to = 0;
-		if (visible_to_everyone(u) || (unit_is(u, UnitTypes::Powerup_Flag) && u->order_type->id == Orders::UnusedPowerup)) visible_to = 0xff;
-		else {
-			visible_to = st.shared_vision[u->owner] | u->parasite_flags;
-			if (u->parasite_flags) {
-				visible_to |= u->parasite_flags;
-				for (size_t i = 0; i != 12; ++i) {
-					if (~u->parasite_flags&(1 << i)) continue;
-					visible_to |= st.shared_vision[i];
-				}
-			}
-		}
-		reveal_sight_at(u->sprite->position, unit_sight_range(u) / 32u, visible_to, u_flying(u));
+		reveal_sight_at(u->sprite->position, unit_sight_range(u) / 32u, unit_sight_reveal_to(u), u_flying(u));
 	}
 
 	void turn_turret(unit_t* u, direction_t turn) {
@@ -12409,6 +13083,7 @@ struct state_functions {
 			turn_turret(u->subunit, u->next_velocity_direction - prev_velocity_direction);
 			u->subunit->exact_position = u->exact_position;
 			u->subunit->position = to_xy(u->exact_position);
+			update_unit_sync_hash(u->subunit);
 			move_sprite(u->subunit->sprite, u->subunit->position);
 			set_image_offset(u->subunit->sprite->main_image, get_image_lo_offset(u->sprite->main_image, 2, 0));
 			auto ius = make_thingy_setter(iscript_unit, u->subunit);
@@ -12816,6 +13491,7 @@ struct state_functions {
 				remove_queued_order(u, &u->order_queue.front());
 			}
 			st.dead_units.remove(*u);
+			remove_unit_sync_hash(u);
 			st.units_container.push(u);
 		}
 	}
@@ -12902,10 +13578,14 @@ struct state_functions {
 			update_dead_unit(u);
 		}
 
-		for (unit_t* u : ptr(st.visible_units)) {
-			iscript_flingy = u;
-			iscript_unit = u;
-			update_unit_movement(u);
+		{
+			BWGAME_PROFILE_PHASE(phase_unit_movement);
+			for (unit_t* u : ptr(st.visible_units)) {
+				iscript_flingy = u;
+				iscript_unit = u;
+				update_unit_movement(u);
+				BWGAME_PROFILE_COUNT(counter_units, 1);
+			}
 		}
 
 		if (update_tiles) {
@@ -12926,11 +13606,14 @@ struct state_functions {
 			}
 		}
 
-		for (auto i = st.visible_units.begin(); i != st.visible_units.end();) {
-			unit_t* u = &*i++;
-			iscript_flingy = u;
-			iscript_unit = u;
-			update_unit(u);
+		{
+			BWGAME_PROFILE_PHASE(phase_update_unit);
+			for (auto i = st.visible_units.begin(); i != st.visible_units.end();) {
+				unit_t* u = &*i++;
+				iscript_flingy = u;
+				iscript_unit = u;
+				update_unit(u);
+			}
 		}
 
 		for (auto i = st.hidden_units.begin(); i != st.hidden_units.end();) {
@@ -12976,6 +13659,7 @@ struct state_functions {
 
 		for (auto i = st.active_bullets.begin(); i != st.active_bullets.end();) {
 			bullet_t* b = &*i++;
+			BWGAME_PROFILE_COUNT(counter_bullets, 1);
 			iscript_bullet = b;
 			iscript_flingy = b;
 			if (b->sprite) {
@@ -13010,6 +13694,7 @@ struct state_functions {
 	void update_thingies() {
 		for (auto i = st.active_thingies.begin(); i != st.active_thingies.end();) {
 			thingy_t* t = &*i++;
+			BWGAME_PROFILE_COUNT(counter_thingies, 1);
 			update_thingy(t);
 		}
 	}
@@ -13081,21 +13766,32 @@ struct state_functions {
 	}
 
 	void process_frame() {
-		recede_creep();
+		{
+			BWGAME_PROFILE_PHASE(phase_recede_creep);
+			recede_creep();
+		}
 
 		if (st.update_tiles_countdown == 0) st.update_tiles_countdown = 100;
 		--st.update_tiles_countdown;
 		update_tiles = st.update_tiles_countdown == 0;
 
-		if (update_tiles) {
-			for (auto& v : st.tiles) {
-				v.visible = 0xff;
-			}
-		}
+		if (update_tiles) reset_tiles_visibility();
+		else prepare_sight_tiles();
 
-		update_units();
-		update_bullets();
-		update_thingies();
+		begin_sight_reveal_set();
+		{
+			BWGAME_PROFILE_PHASE(phase_update_units);
+			update_units();
+		}
+		{
+			BWGAME_PROFILE_PHASE(phase_update_bullets);
+			update_bullets();
+		}
+		{
+			BWGAME_PROFILE_PHASE(phase_update_thingies);
+			update_thingies();
+		}
+		end_sight_reveal_set();
 	}
 
 	void process_triggers() {
@@ -13183,10 +13879,26 @@ struct state_functions {
 		}
 	}
 
+	// Ends the read phase of the previous frame. next_frame calls this itself,
+	// anything else that modifies the state between frames (like executing
+	// actions) must call it first.
+	void end_read_phase() {
+		if (read_phase) read_phase->end();
+	}
+
 	void next_frame() {
-		++st.current_frame;
-		process_frame();
-		process_triggers();
+		end_read_phase();
+		{
+			BWGAME_PROFILE_PHASE(phase_frame);
+			++st.current_frame;
+			process_frame();
+			{
+				BWGAME_PROFILE_PHASE(phase_process_triggers);
+				process_triggers();
+			}
+		}
+		BWGAME_PROFILE_END_FRAME(st.current_frame);
+		if (read_phase) read_phase->begin(st);
 	}
 
 	int lcg_rand(int source) {
@@ -13619,6 +14331,7 @@ struct state_functions {
 		on_unit_damage(u, source_unit, reveal_source);
 		if (damage < u->hp) {
 			u->hp -= damage;
+			update_unit_sync_hash(u);
 			u->air_strength = get_unit_strength(u, false);
 			u->ground_strength = get_unit_strength(u, true);
 			if (u_completed(u)) {
@@ -13635,6 +14348,7 @@ struct state_functions {
 				}
 			}
 			u->hp = 0_fp8;
+			update_unit_sync_hash(u);
 			kill_unit(u);
 			// todo: units lost scores
 			if (source_unit && unit_target_is_enemy(source_unit, u)) {
@@ -13704,6 +14418,7 @@ struct state_functions {
 		unit_deal_damage(target, damage, source_unit, source_owner, weapon->id != WeaponTypes::Irradiate);
 		if (shield_damage != 0_fp8) {
 			target->shield_points -= shield_damage;
+			update_unit_sync_hash(target);
 			if (weapon->damage_type != weapon_type_t::damage_type_none && target->shield_points != 0_fp8) {
 				create_shield_damage_effect(target, heading);
 			}
@@ -13892,6 +14607,7 @@ struct state_functions {
 			if (target->stasis_timer) continue;
 			target->energy = 0_fp8;
 			target->shield_points = 0_fp8;
+			update_unit_sync_hash(target);
 		}
 	}
 
@@ -14713,6 +15429,7 @@ struct state_functions {
 			size_t pc = p - program_data;
 			if (pc == 0) error("iscript: program counter is null");
 			int opc = *p++ - 0x808091;
+			BWGAME_PROFILE_COUNT(counter_iscript_ops, 1);
 			int a, b, c;
 			switch (opc) {
 			case opc_playfram:
@@ -15478,6 +16195,13 @@ struct state_functions {
 		if (st.unit_counts[u->owner][u->unit_type->id] < 0) st.unit_counts[u->owner][u->unit_type->id] = 0;
 	}
 
+	void set_unit_finder_bounding_box(unit_t* u, rect bb) {
+		u->unit_finder_bounding_box = bb;
+		auto& bbs = st.unit_finder_bounding_boxes;
+		if (u->index >= bbs.size()) bbs.resize(u->index + 1);
+		bbs[u->index] = bb;
+	}
+
 	void unit_finder_insert(unit_t* u) {
 		if (ut_turret(u)) return;
 
@@ -15491,6 +16215,268 @@ struct state_functions {
 		unit_finder_reinsert(u, bb);
 	}
 
+#ifdef BWGAME_GRID_UNIT_FINDER
+
+	// The grid stores every unit in each cell its bounding box overlaps. Each
+	// bounding box edge carries an order key that reproduces how the sorted
+	// unit_finder_x/unit_finder_y vectors break ties between equal values, so
+	// sorting candidates by (value, order) yields the same sequence.
+
+	static const int unit_finder_grid_cell_shift = 6;
+
+	size_t unit_finder_grid_cell(int value, size_t size) const {
+		if (value < 0) return 0;
+		size_t r = (size_t)value >> unit_finder_grid_cell_shift;
+		return r < size ? r : size - 1;
+	}
+
+	template<typename F>
+	void unit_finder_grid_for_each_cell(rect bb, F&& f) {
+		auto& grid = st.unit_finder_grid;
+		size_t from_x = unit_finder_grid_cell(bb.from.x, grid.width);
+		size_t to_x = unit_finder_grid_cell(bb.to.x, grid.width);
+		size_t from_y = unit_finder_grid_cell(bb.from.y, grid.height);
+		size_t to_y = unit_finder_grid_cell(bb.to.y, grid.height);
+		for (size_t y = from_y; y <= to_y; ++y) {
+			for (size_t x = from_x; x <= to_x; ++x) {
+				f(grid.cells[y * grid.width + x]);
+			}
+		}
+	}
+
+	void unit_finder_grid_add(unit_t* u, rect bb) {
+		auto& grid = st.unit_finder_grid;
+		if (grid.cells.empty()) {
+			grid.width = std::max(((game_st.map_width + 31) >> unit_finder_grid_cell_shift) + 1, (size_t)1);
+			grid.height = std::max(((game_st.map_height + 31) >> unit_finder_grid_cell_shift) + 1, (size_t)1);
+			grid.cells.resize(grid.width * grid.height);
+		}
+		unit_finder_grid_for_each_cell(bb, [&](a_vector<unit_t*>& cell) {
+			cell.push_back(u);
+		});
+	}
+
+	void unit_finder_grid_erase(unit_t* u, rect bb) {
+		unit_finder_grid_for_each_cell(bb, [&](a_vector<unit_t*>& cell) {
+			auto i = std::find(cell.begin(), cell.end(), u);
+			if (i == cell.end()) error("unit_finder_grid_erase: unit not found");
+			*i = cell.back();
+			cell.pop_back();
+		});
+	}
+
+	void unit_finder_remove(unit_t* u) {
+		if (u->unit_finder_bounding_box.from.x == -1) return;
+		if (unit_finder_search_index) error("attempt to modify unit finder while search is active");
+		unit_finder_grid_erase(u, u->unit_finder_bounding_box);
+		set_unit_finder_bounding_box(u, {{-1, -1}, {-1, -1}});
+	}
+
+	void unit_finder_insert(unit_t* u, rect bb) {
+		if (unit_finder_search_index) error("attempt to modify unit finder while search is active");
+		auto& grid = st.unit_finder_grid;
+		u->unit_finder_order[0] = --grid.front_order;
+		u->unit_finder_order[1] = --grid.front_order;
+		u->unit_finder_order[2] = --grid.front_order;
+		u->unit_finder_order[3] = --grid.front_order;
+		unit_finder_grid_add(u, bb);
+		set_unit_finder_bounding_box(u, bb);
+	}
+	void unit_finder_reinsert(unit_t* u, rect bb) {
+		if (unit_finder_search_index) error("attempt to modify unit finder while search is active");
+		auto& grid = st.unit_finder_grid;
+		auto reinsert = [&](int64_t& order, int old_value, int new_value) {
+			if (old_value == new_value) return;
+			if (new_value > old_value) order = --grid.front_order;
+			else order = ++grid.back_order;
+		};
+		rect old_bb = u->unit_finder_bounding_box;
+		if (bb.from.x <= old_bb.from.x) {
+			reinsert(u->unit_finder_order[0], old_bb.from.x, bb.from.x);
+			reinsert(u->unit_finder_order[1], old_bb.to.x, bb.to.x);
+		} else {
+			reinsert(u->unit_finder_order[1], old_bb.to.x, bb.to.x);
+			reinsert(u->unit_finder_order[0], old_bb.from.x, bb.from.x);
+		}
+		if (bb.from.y <= old_bb.from.y) {
+			reinsert(u->unit_finder_order[2], old_bb.from.y, bb.from.y);
+			reinsert(u->unit_finder_order[3], old_bb.to.y, bb.to.y);
+		} else {
+			reinsert(u->unit_finder_order[3], old_bb.to.y, bb.to.y);
+			reinsert(u->unit_finder_order[2], old_bb.from.y, bb.from.y);
+		}
+		auto cells = [&](rect bb) {
+			return std::make_tuple(unit_finder_grid_cell(bb.from.x, grid.width), unit_finder_grid_cell(bb.to.x, grid.width), unit_finder_grid_cell(bb.from.y, grid.height), unit_finder_grid_cell(bb.to.y, grid.height));
+		};
+		if (cells(old_bb) != cells(bb)) {
+			unit_finder_grid_erase(u, old_bb);
+			unit_finder_grid_add(u, bb);
+		}
+		set_unit_finder_bounding_box(u, bb);
+	}
+
+	a_vector<unit_finder_grid_entry>& unit_finder_grid_acquire_scratch() const {
+		if (unit_finder_grid_scratch_depth == unit_finder_grid_scratch.size()) error("unit finder grid: too many active searches");
+		return unit_finder_grid_scratch[unit_finder_grid_scratch_depth++];
+	}
+
+	void unit_finder_grid_release_scratch(a_vector<unit_finder_grid_entry>& entries) const {
+		if (&entries != &unit_finder_grid_scratch[unit_finder_grid_scratch_depth - 1]) error("unit finder grid: searches released out of order");
+		--unit_finder_grid_scratch_depth;
+	}
+
+	// Collects the bounding box edges along one axis whose value is in [from_value, to_value),
+	// for units whose bounding box reaches cross_from and cross_to on the other axis (that is,
+	// from <= cross_to && to >= cross_from). This is only checked at cell granularity, the
+	// caller still has to test. The result is in the same order the sorted
+	// unit_finder_x/unit_finder_y vectors would have.
+	void unit_finder_grid_collect(a_vector<unit_finder_grid_entry>& r, bool y_axis, int from_value, int to_value, int cross_from, int cross_to) const {
+		r.clear();
+		auto& grid = st.unit_finder_grid;
+		if (grid.cells.empty() || from_value >= to_value) return;
+		if (cross_from > cross_to) std::swap(cross_from, cross_to);
+		size_t from_x = unit_finder_grid_cell(y_axis ? cross_from : from_value, grid.width);
+		size_t to_x = unit_finder_grid_cell(y_axis ? cross_to : to_value - 1, grid.width);
+		size_t from_y = unit_finder_grid_cell(y_axis ? from_value : cross_from, grid.height);
+		size_t to_y = unit_finder_grid_cell(y_axis ? to_value - 1 : cross_to, grid.height);
+		for (size_t y = from_y; y <= to_y; ++y) {
+			for (size_t x = from_x; x <= to_x; ++x) {
+				for (unit_t* u : grid.cells[y * grid.width + x]) {
+					auto& bb = u->unit_finder_bounding_box;
+					if (x != std::max(unit_finder_grid_cell(bb.from.x, grid.width), from_x)) continue;
+					if (y != std::max(unit_finder_grid_cell(bb.from.y, grid.height), from_y)) continue;
+					int from = y_axis ? bb.from.y : bb.from.x;
+					int to = y_axis ? bb.to.y : bb.to.x;
+					if (from >= from_value && from < to_value) r.push_back({u, from, (uint32_t)u->index, u->unit_finder_order[y_axis ? 2 : 0]});
+					if (to >= from_value && to < to_value) r.push_back({u, to, (uint32_t)u->index, u->unit_finder_order[y_axis ? 3 : 1]});
+				}
+			}
+		}
+		std::sort(r.begin(), r.end(), [&](auto& a, auto& b) {
+			if (a.value != b.value) return a.value < b.value;
+			return a.order < b.order;
+		});
+	}
+
+	struct unit_finder_entries_range {
+		using iterator = a_vector<unit_finder_grid_entry>::iterator;
+	private:
+		friend state_functions;
+		const state_functions& funcs;
+		a_vector<unit_finder_grid_entry>& entries;
+		unit_finder_entries_range(const state_functions& funcs, bool y_axis, int from_value, int to_value, int cross_from, int cross_to) : funcs(funcs), entries(funcs.unit_finder_grid_acquire_scratch()) {
+			funcs.unit_finder_grid_collect(entries, y_axis, from_value, to_value, cross_from, cross_to);
+		}
+	public:
+		unit_finder_entries_range(const unit_finder_entries_range&) = delete;
+		~unit_finder_entries_range() {
+			funcs.unit_finder_grid_release_scratch(entries);
+		}
+		iterator begin() {
+			return entries.begin();
+		}
+		iterator end() {
+			return entries.end();
+		}
+	};
+
+	unit_finder_entries_range unit_finder_entries(bool y_axis, int from_value, int to_value, int cross_from, int cross_to) const {
+		return unit_finder_entries_range(*this, y_axis, from_value, to_value, cross_from, cross_to);
+	}
+
+	struct unit_finder_search {
+		using value_type = unit_t*;
+
+		struct iterator {
+			using value_type = unit_t*;
+			using iterator_category = std::forward_iterator_tag;
+		private:
+			a_vector<unit_finder_grid_entry>::iterator i;
+			friend unit_finder_search;
+			explicit iterator(a_vector<unit_finder_grid_entry>::iterator i) : i(i) {}
+		public:
+
+			unit_t* operator*() const {
+				return i->u;
+			}
+
+			unit_t* operator->() const {
+				return i->u;
+			}
+
+			iterator& operator++() {
+				++i;
+				return *this;
+			}
+
+			iterator operator++(int) {
+				auto r = *this;
+				++*this;
+				return r;
+			}
+
+			bool operator==(const iterator& n) const {
+				return i == n.i;
+			}
+			bool operator!=(const iterator& n) const {
+				return i != n.i;
+			}
+		};
+
+	private:
+		friend state_functions;
+		const state_functions& funcs;
+		a_vector<unit_finder_grid_entry>* results;
+		unit_finder_search(const state_functions& funcs, rect area, bool expand) : funcs(funcs) {
+			if (funcs.unit_finder_search_index == 4) error("unit_finder_search maximum recursive depth reached");
+			++funcs.unit_finder_search_index;
+			results = &funcs.unit_finder_grid_acquire_scratch();
+
+			int begin_x = area.from.x;
+			int end_x = area.to.x;
+			if (expand) {
+				if (end_x - begin_x + 1 < funcs.game_st.max_unit_width) {
+					end_x = begin_x + funcs.game_st.max_unit_width - 1;
+					++area.to.x;
+				}
+				if (area.to.y - area.from.y + 1 < funcs.game_st.max_unit_height) {
+					++area.to.y;
+				}
+			}
+			// Each unit is reported at the first of its x edges in [begin_x, end_x), in the
+			// same order as the sorted vector walk.
+			funcs.unit_finder_grid_collect(*results, false, begin_x, end_x, area.from.y, area.to.y - 1);
+			auto out = results->begin();
+			for (auto& v : *results) {
+				unit_t* u = v.u;
+				auto& bb = funcs.st.unit_finder_bounding_boxes[v.index];
+				if (bb.from.x >= area.to.x) continue;
+				if (bb.from.y >= area.to.y) continue;
+				if (bb.to.y < area.from.y) continue;
+				if (bb.from.x >= begin_x && bb.to.x < end_x) {
+					bool from_first = bb.from.x != bb.to.x || u->unit_finder_order[0] < u->unit_finder_order[1];
+					if (v.order != u->unit_finder_order[from_first ? 0 : 1]) continue;
+				}
+				*out++ = v;
+			}
+			results->erase(out, results->end());
+		}
+	public:
+		unit_finder_search(const unit_finder_search&) = delete;
+		~unit_finder_search() {
+			funcs.unit_finder_grid_release_scratch(*results);
+			--funcs.unit_finder_search_index;
+		}
+
+		iterator begin() {
+			return iterator(results->begin());
+		}
+		iterator end() {
+			return iterator(results->end());
+		}
+	};
+
+#else
 	void unit_finder_remove(unit_t* u) {
 		if (u->unit_finder_bounding_box.from.x == -1) return;
 		if (unit_finder_search_index) error("attempt to modify unit finder while search is active");
@@ -15506,7 +16492,7 @@ struct state_functions {
 		remove(st.unit_finder_x, u->unit_finder_bounding_box.to.x);
 		remove(st.unit_finder_y, u->unit_finder_bounding_box.from.y);
 		remove(st.unit_finder_y, u->unit_finder_bounding_box.to.y);
-		u->unit_finder_bounding_box = {{-1, -1}, {-1, -1}};
+		set_unit_finder_bounding_box(u, {{-1, -1}, {-1, -1}});
 	}
 
 	void unit_finder_insert(unit_t* u, rect bb) {
@@ -15516,13 +16502,13 @@ struct state_functions {
 				return a.value < b;
 			};
 			auto from_i = std::lower_bound(vec.begin(), vec.end(), from_value, cmp_l);
-			vec.insert(from_i, {u, from_value});
+			vec.insert(from_i, {u, from_value, (uint32_t)u->index});
 			auto to_i = std::lower_bound(vec.begin(), vec.end(), to_value, cmp_l);
-			vec.insert(to_i, {u, to_value});
+			vec.insert(to_i, {u, to_value, (uint32_t)u->index});
 		};
 		insert(st.unit_finder_x, bb.from.x, bb.to.x);
 		insert(st.unit_finder_y, bb.from.y, bb.to.y);
-		u->unit_finder_bounding_box = bb;
+		set_unit_finder_bounding_box(u, bb);
 	}
 	void unit_finder_reinsert(unit_t* u, rect bb) {
 		if (unit_finder_search_index) error("attempt to modify unit finder while search is active");
@@ -15540,7 +16526,7 @@ struct state_functions {
 					++i;
 					++ni;
 				}
-				*i = {u, new_value};
+				*i = {u, new_value, (uint32_t)u->index};
 			} else {
 				while (i != vec.begin()) {
 					auto ni = i;
@@ -15551,7 +16537,7 @@ struct state_functions {
 					}
 					*ni = *i;
 				}
-				*i = {u, new_value};
+				*i = {u, new_value, (uint32_t)u->index};
 			}
 		};
 		if (bb.from.x <= u->unit_finder_bounding_box.from.x) {
@@ -15568,10 +16554,22 @@ struct state_functions {
 			reinsert(st.unit_finder_y, u->unit_finder_bounding_box.to.y, bb.to.y);
 			reinsert(st.unit_finder_y, u->unit_finder_bounding_box.from.y, bb.from.y);
 		}
-		u->unit_finder_bounding_box = bb;
+		set_unit_finder_bounding_box(u, bb);
 	}
 
 
+	using unit_finder_entries_range = iterators_range<a_vector<state::unit_finder_entry>::iterator>;
+
+	unit_finder_entries_range unit_finder_entries(bool y_axis, int from_value, int to_value, int cross_from, int cross_to) const {
+		auto& vec = y_axis ? st.unit_finder_y : st.unit_finder_x;
+		auto cmp_l = [&](auto& a, int b) {
+			return a.value < b;
+		};
+		auto begin = std::lower_bound(vec.begin(), vec.end(), from_value, cmp_l);
+		auto end = std::lower_bound(begin, vec.end(), to_value, cmp_l);
+		return make_iterators_range(begin, end);
+	}
+
 	struct unit_finder_search {
 		using value_type = unit_t*;
 
@@ -15584,10 +16582,10 @@ struct state_functions {
 			friend unit_finder_search;
 			iterator(const unit_finder_search* search, a_vector<state::unit_finder_entry>::iterator i) : search(search), i(i) {}
 			bool in_bounds() {
-				unit_t* u = i->u;
-				if (u->unit_finder_bounding_box.from.x >= search->area.to.x) return false;
-				if (u->unit_finder_bounding_box.from.y >= search->area.to.y) return false;
-				if (u->unit_finder_bounding_box.to.y < search->area.from.y) return false;
+				auto& bb = search->funcs.st.unit_finder_bounding_boxes[i->index];
+				if (bb.from.x >= search->area.to.x) return false;
+				if (bb.from.y >= search->area.to.y) return false;
+				if (bb.to.y < search->area.from.y) return false;
 				return true;
 			}
 		public:
@@ -15673,6 +16671,8 @@ struct state_functions {
 		}
 	};
 
+#endif
+
 	unit_finder_search find_units(rect area) const {
 		return unit_finder_search(*this, area, true);
 	}
@@ -15697,13 +16697,27 @@ struct state_functions {
 		return nullptr;
 	}
 
-	template<typename F, typename i_T>
-	unit_t* find_nearest_unit(xy pos, rect search_area, i_T left_i, i_T up_i, i_T right_i, i_T down_i, F&& predicate) const {
+	// The edges a find_nearest_unit scan that starts in [from_value, to_value] can visit. The scan
+	// stops at the first edge whose unit lies outside the search area, which is certain once the
+	// edge is more than a unit size away from it, so the grid only needs to collect that strip
+	// (at any position on the other axis).
+	unit_finder_entries_range unit_finder_nearest_entries(bool y_axis, int from_value, int to_value) const {
+#ifdef BWGAME_GRID_UNIT_FINDER
+		int pad = (y_axis ? game_st.max_unit_height : game_st.max_unit_width) + 1;
+		return unit_finder_entries(y_axis, from_value - pad, to_value + pad, std::numeric_limits<int>::min(), std::numeric_limits<int>::max());
+#else
+		auto& vec = y_axis ? st.unit_finder_y : st.unit_finder_x;
+		return make_iterators_range(vec.begin(), vec.end());
+#endif
+	}
+
+	template<typename F, typename range_T, typename i_T>
+	unit_t* find_nearest_unit(xy pos, rect search_area, range_T& x_entries, range_T& y_entries, i_T left_i, i_T up_i, i_T right_i, i_T down_i, F&& predicate) const {
 
-		const auto x_begin = st.unit_finder_x.begin();
-		const auto y_begin = st.unit_finder_y.begin();
-		const auto x_end = st.unit_finder_x.end();
-		const auto y_end = st.unit_finder_y.end();
+		const auto x_begin = x_entries.begin();
+		const auto y_begin = y_entries.begin();
+		const auto x_end = x_entries.end();
+		const auto y_end = y_entries.end();
 
 		int best_distance = xy_length({std::max(pos.x - search_area.from.x, search_area.to.x - pos.x), std::max(pos.y - search_area.from.y, search_area.to.y - pos.y)});
 		unit_t* best_unit = nullptr;
@@ -15792,10 +16806,12 @@ struct state_functions {
 		auto cmp_l = [&](auto& a, int b) {
 			return a.value < b;
 		};
-		auto x_i = std::lower_bound(st.unit_finder_x.begin(), st.unit_finder_x.end(), pos.x, cmp_l);
-		auto y_i = std::lower_bound(st.unit_finder_y.begin(), st.unit_finder_y.end(), pos.y, cmp_l);
+		auto x_entries = unit_finder_nearest_entries(false, std::min(search_area.from.x, pos.x), std::max(search_area.to.x, pos.x));
+		auto y_entries = unit_finder_nearest_entries(true, std::min(search_area.from.y, pos.y), std::max(search_area.to.y, pos.y));
+		auto x_i = std::lower_bound(x_entries.begin(), x_entries.end(), pos.x, cmp_l);
+		auto y_i = std::lower_bound(y_entries.begin(), y_entries.end(), pos.y, cmp_l);
 
-		return find_nearest_unit(pos, search_area, x_i, y_i, x_i, y_i, predicate);
+		return find_nearest_unit(pos, search_area, x_entries, y_entries, x_i, y_i, x_i, y_i, predicate);
 	}
 
 	template<typename F>
@@ -15811,11 +16827,14 @@ struct state_functions {
 				while (i->u != u) ++i;
 				return i;
 			};
-			auto left_i = get(st.unit_finder_x, u->unit_finder_bounding_box.to.x);
-			auto up_i = get(st.unit_finder_y, u->unit_finder_bounding_box.to.y);
-			auto right_i = std::next(get(st.unit_finder_x, u->unit_finder_bounding_box.from.x));
-			auto down_i = std::next(get(st.unit_finder_y, u->unit_finder_bounding_box.from.y));
-			return find_nearest_unit(u->sprite->position, search_area, left_i, up_i, right_i, down_i, std::forward<F>(predicate));
+			auto& bb = u->unit_finder_bounding_box;
+			auto x_entries = unit_finder_nearest_entries(false, std::min(search_area.from.x, bb.from.x), std::max(search_area.to.x, bb.to.x));
+			auto y_entries = unit_finder_nearest_entries(true, std::min(search_area.from.y, bb.from.y), std::max(search_area.to.y, bb.to.y));
+			auto left_i = get(x_entries, bb.to.x);
+			auto up_i = get(y_entries, bb.to.y);
+			auto right_i = std::next(get(x_entries, bb.from.x));
+			auto down_i = std::next(get(y_entries, bb.from.y));
+			return find_nearest_unit(u->sprite->position, search_area, x_entries, y_entries, left_i, up_i, right_i, down_i, std::forward<F>(predicate));
 		}
 	}
 
@@ -16148,6 +17167,7 @@ struct state_functions {
 				u->order_state = 0;
 				u->order_unit_type = nullptr;
 				u->hp = u->unit_type->hitpoints;
+				update_unit_sync_hash(u);
 				set_unit_owner(u, 11, false);
 				set_sprite_owner(u, 11);
 				u_set_status_flag(u, unit_t::status_flag_completed);
@@ -16221,12 +17241,14 @@ struct state_functions {
 		destroy_unit_impl(u);
 		u->order_type = get_order_type(Orders::Die);
 		u->order_state = 1;
+		update_unit_sync_hash(u);
 		destroy_sprite(u->sprite);
 		u->sprite = nullptr;
 	}
 
 	bool initialize_unit(unit_t* u, const unit_type_t* unit_type, xy pos, int owner) {
 
+		u->sync_hash = 0;
 		u->order_queue.clear();
 
 		u->auto_target_unit = nullptr;
@@ -16277,8 +17299,9 @@ struct state_functions {
 		else u->hp = u->unit_type->hitpoints / 10;
 		if (u_grounded_building(u)) u->order_type = u->unit_type->human_ai_idle;
 		else u->order_type = get_order_type(Orders::Nothing);
+		update_unit_sync_hash(u);
 		set_secondary_order(u, get_order_type(Orders::Nothing));
-		u->unit_finder_bounding_box = { {-1, -1}, {-1, -1} };
+		set_unit_finder_bounding_box(u, {{-1, -1}, {-1, -1}});
 		st.player_units[owner].push_front(*u);
 		increment_unit_counts(u, 1);
 
@@ -16324,6 +17347,7 @@ struct state_functions {
 				return (unit_t*)nullptr;
 			}
 			if (!initialize_unit(u, unit_type, pos, owner)) {
+				remove_unit_sync_hash(u);
 				st.last_error = 62; // Unable to create unit
 				return (unit_t*)nullptr;
 			}
@@ -16474,6 +17498,7 @@ struct state_functions {
 			u->hp = u->unit_type->hitpoints;
 			u->shield_points = fp8::integer(u->unit_type->shield_points);
 			u->remaining_build_time = 0;
+			update_unit_sync_hash(u);
 		}
 		if (u_grounded_building(u)) {
 			u->parasite_flags = 0;
@@ -16692,6 +17717,7 @@ struct state_functions {
 		pos = restrict_move_target_to_valid_bounds(u, pos);
 		u->position = pos;
 		u->exact_position = to_xy_fp8(pos);
+		update_unit_sync_hash(u);
 		move_sprite(u->sprite, pos);
 		if (u->order_type->id != Orders::Die) {
 			set_unit_move_target(u, pos);
@@ -16901,6 +17927,7 @@ struct state_functions {
 
 		u->order_type = order_type;
 		u->order_state = 0;
+		update_unit_sync_hash(u);
 
 		if (target.unit) {
 			if (unit_dead(target.unit) || !target.unit->sprite) error("attempt to activate order with dead target");
@@ -19675,23 +20702,37 @@ struct state_copier {
 	void remap_order(T& v) {
 		if (v) v = order(v);
 	}
+	// Paths and thingies already allocated in r (if it is not a fresh state) are
+	// reused in order, so copying into the same state repeatedly keeps addresses.
+	a_list<path_t>::iterator next_path = r.paths.begin();
 	a_unordered_map<const path_t*, path_t*> path_remap;
 	path_t* path(const path_t* v) {
 		if (!v) return nullptr;
 		auto*& rv = path_remap[v];
 		if (!rv) {
-			r.paths.emplace_back(*v);
-			rv = &r.paths.back();
+			if (next_path == r.paths.end()) {
+				r.paths.emplace_back(*v);
+				rv = &r.paths.back();
+			} else {
+				*next_path = *v;
+				rv = &*next_path++;
+			}
 		}
 		return rv;
 	}
+	a_list<thingy_t>::iterator next_thingy = r.thingies.begin();
 	a_unordered_map<const thingy_t*, thingy_t*> thingy_remap;
 	thingy_t* thingy(const thingy_t* v) {
 		if (!v) return nullptr;
 		auto*& rv = thingy_remap[v];
 		if (!rv) {
-			r.thingies.emplace_back(*v);
-			rv = &r.thingies.back();
+			if (next_thingy == r.thingies.end()) {
+				r.thingies.emplace_back(*v);
+				rv = &r.thingies.back();
+			} else {
+				*next_thingy = *v;
+				rv = &*next_thingy++;
+			}
 			remap_sprite(rv->sprite);
 		}
 		return rv;
@@ -19737,10 +20778,18 @@ struct state_copier {
 		assemble(r.hidden_units, st.hidden_units, &state_copier::unit);
 		assemble(r.visible_units, st.visible_units, &state_copier::unit);
 
+#ifdef BWGAME_GRID_UNIT_FINDER
+		r.unit_finder_grid = st.unit_finder_grid;
+		for (auto& c : r.unit_finder_grid.cells) {
+			for (auto& v : c) remap_unit(v);
+		}
+#else
 		r.unit_finder_x = st.unit_finder_x;
 		for (auto& v : r.unit_finder_x) remap_unit(v.u);
 		r.unit_finder_y = st.unit_finder_y;
 		for (auto& v : r.unit_finder_y) remap_unit(v.u);
+#endif
+		r.unit_finder_bounding_boxes = st.unit_finder_bounding_boxes;
 
 		r.consider_collision_with_unit_bug = st.consider_collision_with_unit_bug;
 		remap_unit(r.consider_collision_with_unit_bug);
@@ -19755,6 +20804,24 @@ static inline state copy_state(const state& st) {
 	return r;
 }
 
+// Rebuilds state::unit_finder_bounding_boxes and the unit indices in the unit
+// finder entries from the units, for states whose units and unit finder were
+// restored directly rather than through state_functions.
+static inline void rebuild_unit_finder_bounding_boxes(state& st) {
+	auto& c = st.units_container;
+	st.unit_finder_bounding_boxes.clear();
+	for (size_t i = 0; i != c.size; ++i) {
+		const unit_t* u = &c.list[i / c.list[0].size()][i % c.list[0].size()];
+		if (u->index >= st.unit_finder_bounding_boxes.size()) st.unit_finder_bounding_boxes.resize(u->index + 1);
+		st.unit_finder_bounding_boxes[u->index] = u->unit_finder_bounding_box;
+	}
+#ifndef BWGAME_GRID_UNIT_FINDER
+	for (auto* vec : {&st.unit_finder_x, &st.unit_finder_y}) {
+		for (auto& v : *vec) v.index = (uint32_t)v.u->index;
+	}
+#endif
+}
+
 
 struct game_load_functions : state_functions {
 
@@ -19770,6 +20837,7 @@ struct game_load_functions : state_functions {
 		int resource_type = 0;
 		int starting_minerals = 50;
 		bool create_no_units = false;
+		bool flow_field_movement = false;
 	};
 	setup_info_t setup_info;
 
@@ -19994,6 +21062,7 @@ struct game_load_functions : state_functions {
 		st.random_counts = {};
 		st.total_random_counts = 0;
 		st.lcg_rand_state = 42;
+		st.units_sync_hash = 0;
 
 		game_st.repulse_field_width = (game_st.map_width + 47) / 48;
 		game_st.repulse_field_height = (game_st.map_height + 47) / 48;
@@ -20818,6 +21887,57 @@ struct game_load_functions : state_functions {
 
 		create_contours();
 
+		create_region_landmarks();
+
+	}
+
+	// Picks up to n landmark regions in the largest group of walkable regions,
+	// each as far as possible from the previous ones, and computes the
+	// distances from them to every region. Regions in other groups only get
+	// trivial lower bounds from region_distance_lower_bound.
+	// This must be called again whenever regions change.
+	void create_region_landmarks(size_t n = 16) {
+		auto& regions = game_st.regions;
+		regions.landmarks.clear();
+		regions.landmark_distances.clear();
+		++regions.generation;
+
+		a_map<size_t, size_t> group_tile_count;
+		for (auto& v : regions.regions) {
+			if (v.walkable()) group_tile_count[v.group_index] += v.tile_count;
+		}
+		const regions_t::region* start = nullptr;
+		size_t largest_tile_count = 0;
+		for (auto& v : regions.regions) {
+			if (v.walkable() && group_tile_count[v.group_index] > largest_tile_count) {
+				largest_tile_count = group_tile_count[v.group_index];
+				start = &v;
+			}
+		}
+		if (!start) return;
+
+		// The first landmark is the region farthest from an arbitrary region of
+		// the group, which puts it at the edge of the map.
+		a_vector<int> nearest = region_distances_from(start);
+		while (regions.landmarks.size() != n) {
+			const regions_t::region* next = nullptr;
+			int next_distance = 0;
+			for (auto& v : regions.regions) {
+				int d = nearest[v.index];
+				if (d != region_distance_unreachable && d > next_distance) {
+					next_distance = d;
+					next = &v;
+				}
+			}
+			if (!next) break;
+			if (regions.landmarks.empty()) nearest.assign(nearest.size(), region_distance_unreachable);
+			regions.landmarks.push_back(next->index);
+			regions.landmark_distances.push_back(region_distances_from(next));
+			auto& distances = regions.landmark_distances.back();
+			for (size_t i = 0; i != nearest.size(); ++i) {
+				nearest[i] = std::min(nearest[i], distances[i]);
+			}
+		}
 	}
 
 	int get_unit_strength(const unit_type_t* unit_type, const weapon_type_t* weapon_type) {
@@ -21795,6 +22915,7 @@ struct game_load_functions : state_functions {
 		}
 
 		use_map_settings = setup_info.victory_condition == 0 && setup_info.tournament_mode == 0 && setup_info.starting_units == 0;
+		game_st.flow_field_movement = setup_info.flow_field_movement;
 
 		if (version == 59 || version == 63) {
 			if (use_map_settings) {
@@ -22326,10 +23447,71 @@ void global_init(global_state& st, load_data_file_F&& load_data_file) {
 
 }
 
+// Loads each data directory's global_state once and hands out shared references to it.
+// A global_state is never modified after global_init, so any number of threads can use
+// the same one concurrently. It is freed when the last reference goes away.
+struct global_state_cache {
+	template<typename load_data_file_F>
+	std::shared_ptr<const global_state> get(const a_string& key, load_data_file_F&& load_data_file) {
+		std::shared_ptr<entry> e;
+		{
+			std::lock_guard<std::mutex> l(mut);
+			auto& v = entries[key];
+			if (!v) v = std::make_shared<entry>();
+			e = v;
+		}
+		std::lock_guard<std::mutex> l(e->mut);
+		auto r = e->ptr.lock();
+		if (!r) {
+			auto global_st = std::make_shared<global_state>();
+			global_init(*global_st, std::forward<load_data_file_F>(load_data_file));
+			r = std::move(global_st);
+			e->ptr = r;
+		}
+		return r;
+	}
+	std::shared_ptr<const global_state> get(const a_string& data_path) {
+		auto load_data_file = data_loading::data_files_directory(data_path);
+		load_data_file.thread_count = std::thread::hardware_concurrency();
+		return get(data_path, std::move(load_data_file));
+	}
+	// Loads the data files through a data_files_cache in cache_filename, which
+	// is written if it lacked any of them. Failing to write it only means that
+	// the next run decompresses the files again.
+	std::shared_ptr<const global_state> get(const a_string& data_path, const a_string& cache_filename) {
+		if (cache_filename.empty()) return get(data_path);
+		auto load_data_file = data_loading::data_files_directory(data_path);
+		load_data_file.thread_count = std::thread::hardware_concurrency();
+		data_loading::data_files_cache<> cache(std::move(load_data_file), cache_filename);
+		auto r = get(data_path, cache);
+		try {
+			cache.save();
+		} catch (const exception&) {
+		}
+		return r;
+	}
+private:
+	struct entry {
+		std::mutex mut;
+		std::weak_ptr<const global_state> ptr;
+	};
+	std::mutex mut;
+	a_unordered_map<a_string, std::shared_ptr<entry>> entries;
+};
+
+static inline global_state_cache& default_global_state_cache() {
+	static global_state_cache cache;
+	return cache;
+}
+
+static inline std::shared_ptr<const global_state> shared_global_state(const a_string& data_path, const a_string& cache_filename = {}) {
+	return default_global_state_cache().get(data_path, cache_filename);
+}
+
 struct game_player {
 private:
-	std::unique_ptr<global_state> uptr_global_st;
-	std::unique_ptr<game_state> uptr_game_st;
+	std::shared_ptr<const global_state> shared_global_st;
+	std::shared_ptr<game_state> shared_game_st;
 	std::unique_ptr<state> uptr_st;
 	optional<state_functions> opt_funcs;
 public:
@@ -22340,24 +23522,52 @@ public:
 		init(std::forward<T>(init_arg));
 	}
 	void init(const char* data_path) {
-		init(data_loading::data_files_directory(data_path));
+		init(shared_global_state(data_path));
 	}
 	void init(a_string data_path) {
-		init(data_loading::data_files_directory(std::move(data_path)));
+		init(shared_global_state(data_path));
 	}
-	template<typename load_data_file_F>
-	void init(load_data_file_F&& load_data_file) {
-		uptr_global_st = std::make_unique<global_state>();
-		uptr_game_st = std::make_unique<game_state>();
+	// Loads the data files through a data_files_cache in cache_filename, see
+	// global_state_cache::get.
+	void init(a_string data_path, a_string cache_filename) {
+		init(shared_global_state(data_path, cache_filename));
+	}
+	void init(std::shared_ptr<const global_state> global_st) {
+		shared_global_st = std::move(global_st);
+		shared_game_st = std::make_shared<game_state>();
 		uptr_st = std::make_unique<state>();
 		state& st = *uptr_st;
-		st.global = uptr_global_st.get();
-		st.game = uptr_game_st.get();
-		global_init(*uptr_global_st, std::forward<load_data_file_F>(load_data_file));
+		st.global = shared_global_st.get();
+		st.game = shared_game_st.get();
 		set_st(st);
 	}
+	template<typename load_data_file_F, typename std::enable_if<!std::is_convertible<load_data_file_F, std::shared_ptr<const global_state>>::value>::type* = nullptr>
+	void init(load_data_file_F&& load_data_file) {
+		auto global_st = std::make_shared<global_state>();
+		global_init(*global_st, std::forward<load_data_file_F>(load_data_file));
+		init(std::shared_ptr<const global_state>(std::move(global_st)));
+	}
+	// Returns a player with its own copy of the state that shares global_state and
+	// game_state with this one. game_state is read-only once the map is loaded, so the
+	// only writer is a later load_map_file, which detaches first (copy-on-write).
+	// Pathfinder scratch space is kept in each player's state_functions and the
+	// shared flow field cache is locked, so forks can run frames concurrently.
+	game_player fork() const {
+		if (!opt_funcs) error("game_player: not initialized");
+		game_player r;
+		r.shared_global_st = shared_global_st;
+		r.shared_game_st = shared_game_st;
+		r.uptr_st = std::make_unique<state>(copy_state(st()));
+		r.set_st(*r.uptr_st);
+		return r;
+	}
 	void load_map_file(const a_string& filename, bool initial_processing = true) {
 		if (!opt_funcs) error("game_player: not initialized");
+		if (shared_game_st && shared_game_st.use_count() != 1) {
+			shared_game_st = std::make_shared<game_state>();
+			st().game = shared_game_st.get();
+			set_st(st());
+		}
 		game_load_functions game_load_funcs(st());
 		game_load_funcs.load_map_file(std::move(filename), {}, initial_processing);
 	}
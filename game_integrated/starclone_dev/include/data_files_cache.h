@@ -0,0 +1,240 @@
+#ifndef BWGAME_DATA_FILES_CACHE_H
+#define BWGAME_DATA_FILES_CACHE_H
+
+#include "data_loading.h"
+#include "mmap_reader.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <random>
+
+namespace bwgame {
+namespace data_loading {
+
+// Checksums of the contents of data files, which a data_files_cache is keyed
+// by. An archive is summed by its size, sector size and hash and block
+// tables, which hold the offset, size and flags of every file in it; this is
+// cheap to get from an open archive, and it changes whenever the archive is
+// rebuilt with different files.
+struct data_files_checksum {
+	uint64_t r = 0xcbf29ce484222325;
+
+	void add(uint64_t v) {
+		r = (r ^ v) * 0x100000001b3;
+	}
+
+	template<typename base_reader_T>
+	void operator()(const mpq_archive_reader<base_reader_T>& mpq) {
+		add(mpq.r.size());
+		add(mpq.sector_size);
+		add(mpq.hash_table.size());
+		for (auto& v : mpq.hash_table) {
+			add(v.hash1);
+			add(v.hash2);
+			add(v.block_index);
+		}
+		add(mpq.block_table.size());
+		for (auto& v : mpq.block_table) {
+			add(v.data_offset);
+			add(v.compressed_size);
+			add(v.size);
+			add(v.flags);
+		}
+	}
+	void operator()(const mpq_data& v) {
+		(*this)(v.mpq);
+	}
+	template<typename file_reader_T>
+	void operator()(const mpq_file<file_reader_T>& v) {
+		(*this)(v.mpq);
+	}
+	template<typename mpq_file_T>
+	void operator()(const data_files_loader<mpq_file_T>& v) {
+		add(v.mpqs.size());
+		for (auto& mpq : v.mpqs) (*this)(mpq);
+	}
+};
+
+// Wraps a data file loader (like data_files_loader) with an on-disk cache of
+// the decompressed files it loads, so that later runs can read them from the
+// cache file instead of decompressing them again:
+//
+//   data_files_cache<> load_data_file(data_files_directory(path), "data.cache");
+//   global_init(global_st, load_data_file);
+//   load_data_file.save();
+//
+// The cache file is mapped into memory and is only used if it was written
+// with the same version of the format and for data files with the same
+// checksum; otherwise every file is loaded from the data files and save
+// replaces it. It holds the files as they are decompressed rather than
+// anything parsed from them, so global_init parses exactly the same bytes
+// with or without the cache.
+//
+// Layout, little endian, with the data of each file aligned to 16 bytes:
+//   u32 magic, u32 version, u64 checksum, u32 file count,
+//   per file: u32 name length, name, u64 offset, u64 size,
+//   the data of the files.
+template<typename load_data_file_T = data_files_loader<>>
+struct data_files_cache {
+	static const uint32_t magic = 0x63647762; // "bwdc"
+	static const uint32_t version = 1;
+
+	load_data_file_T load_data_file;
+	a_string filename;
+	uint64_t checksum;
+
+	data_files_cache(load_data_file_T arg_load_data_file, a_string arg_filename) : load_data_file(std::move(arg_load_data_file)), filename(std::move(arg_filename)) {
+		data_files_checksum sum;
+		sum(load_data_file);
+		checksum = sum.r;
+		try {
+			cache_r.open(filename);
+			read_index();
+		} catch (const exception&) {
+			files.clear();
+			cache_r.close();
+		}
+	}
+	data_files_cache(const data_files_cache&) = delete;
+	data_files_cache& operator=(const data_files_cache&) = delete;
+
+	void operator()(a_vector<uint8_t>& dst, a_string name) {
+		a_string key = file_key(name);
+		auto i = files.find(key);
+		if (i != files.end()) {
+			dst.assign(i->second.data, i->second.data + i->second.size);
+			return;
+		}
+		load_data_file(dst, std::move(name));
+		loaded.push_back(dst);
+		files[std::move(key)] = {loaded.back().data(), loaded.back().size()};
+		modified = true;
+	}
+
+	// Writes the cache file if any file had to be loaded from the data files.
+	// The file is written under a temporary name and then renamed, so that
+	// concurrent readers see either the old or the new cache.
+	void save() {
+		if (!modified) return;
+		a_vector<const a_string*> names;
+		for (auto& v : files) names.push_back(&v.first);
+		std::sort(names.begin(), names.end(), [](const a_string* a, const a_string* b) {
+			return *a < *b;
+		});
+
+		a_vector<uint8_t> index;
+		auto put = [&](auto v) {
+			size_t pos = index.size();
+			index.resize(pos + sizeof(v));
+			set_value_at<true>(index.data() + pos, v);
+		};
+		size_t data_offset = 20;
+		for (auto* n : names) data_offset += 4 + n->size() + 16;
+		data_offset = align(data_offset);
+		put((uint32_t)magic);
+		put((uint32_t)version);
+		put((uint64_t)checksum);
+		put((uint32_t)names.size());
+		size_t offset = data_offset;
+		for (auto* n : names) {
+			auto& v = files[*n];
+			put((uint32_t)n->size());
+			index.insert(index.end(), n->begin(), n->end());
+			put((uint64_t)offset);
+			put((uint64_t)v.size);
+			offset = align(offset + v.size);
+		}
+		index.resize(data_offset);
+
+		// The temporary file is in the same directory so that the rename does not
+		// cross file systems, and has a name of its own so that processes saving
+		// at the same time do not write to the same file.
+		a_string tmp_filename;
+		FILE* f = nullptr;
+		std::random_device rd;
+		for (int i = 0; !f && i != 16; ++i) {
+			tmp_filename = format("%s.%lu.%08x.tmp", filename, process_id(), (uint32_t)rd());
+			f = fopen(tmp_filename.c_str(), "wbx");
+		}
+		if (!f) error("data_files_cache: failed to open %s for writing", tmp_filename);
+		bool ok = fwrite(index.data(), index.size(), 1, f) == 1;
+		const uint8_t padding[16] = {};
+		for (auto* n : names) {
+			if (!ok) break;
+			auto& v = files[*n];
+			if (v.size) ok = fwrite(v.data, v.size, 1, f) == 1;
+			if (ok && align(v.size) != v.size) ok = fwrite(padding, align(v.size) - v.size, 1, f) == 1;
+		}
+		if (fclose(f) || !ok) {
+			std::remove(tmp_filename.c_str());
+			error("data_files_cache: %s: write error", tmp_filename);
+		}
+		cache_r.close();
+#ifdef _WIN32
+		std::remove(filename.c_str());
+#endif
+		if (std::rename(tmp_filename.c_str(), filename.c_str())) error("data_files_cache: failed to rename %s to %s", tmp_filename, filename);
+		// The files that were read from the old cache file are now unmapped.
+		files.clear();
+		loaded.clear();
+		modified = false;
+		cache_r.open(filename);
+		read_index();
+	}
+
+private:
+	struct file_t {
+		const uint8_t* data;
+		size_t size;
+	};
+	mmap_reader cache_r;
+	a_unordered_map<a_string, file_t> files;
+	// The files that were loaded from the data files.
+	a_list<a_vector<uint8_t>> loaded;
+	bool modified = false;
+
+	static unsigned long process_id() {
+#ifdef _WIN32
+		return GetCurrentProcessId();
+#else
+		return getpid();
+#endif
+	}
+
+	static size_t align(size_t n) {
+		return (n + 15) & ~(size_t)15;
+	}
+
+	// Files are named the same way as in the archives: case insensitive, with
+	// either slash.
+	static a_string file_key(const a_string& name) {
+		a_string r = name;
+		for (auto& c : r) {
+			if (c == '/') c = '\\';
+			else if (c >= 'a' && c <= 'z') c += 'A' - 'a';
+		}
+		return r;
+	}
+
+	void read_index() {
+		auto& r = cache_r;
+		r.seek(0);
+		if (r.get<uint32_t>() != magic) error("data_files_cache: %s: not a cache file", filename);
+		if (r.get<uint32_t>() != version) error("data_files_cache: %s: version mismatch", filename);
+		if (r.get<uint64_t>() != checksum) error("data_files_cache: %s: checksum mismatch", filename);
+		size_t n = r.get<uint32_t>();
+		for (size_t i = 0; i != n; ++i) {
+			size_t name_size = r.get<uint32_t>();
+			const uint8_t* name = r.get_n(name_size);
+			uint64_t offset = r.get<uint64_t>();
+			uint64_t size = r.get<uint64_t>();
+			if (offset > r.size() || size > r.size() - offset) error("data_files_cache: %s: file data out of bounds", filename);
+			files[a_string((const char*)name, name_size)] = {r.begin + (size_t)offset, (size_t)size};
+		}
+	}
+};
+
+}
+}
+
+#endif
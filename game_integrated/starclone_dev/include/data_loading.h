@@ -9,6 +9,11 @@
 #include <array>
 #include <cstring>
 #include <cstdio>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <system_error>
+#include <thread>
 
 namespace bwgame {
 namespace data_loading {
@@ -210,6 +215,7 @@ template<bool default_little_endian = true>
 struct file_reader {
 	a_string filename;
 	FILE* f = nullptr;
+	size_t file_size = 0;
 	file_reader() = default;
 	explicit file_reader(a_string filename) {
 		open(std::move(filename));
@@ -219,12 +225,16 @@ struct file_reader {
 	}
 	file_reader(const file_reader&) = delete;
 	file_reader(file_reader&& n) {
+		filename = std::move(n.filename);
 		f = n.f;
 		n.f = nullptr;
+		file_size = n.file_size;
 	}
 	file_reader& operator=(const file_reader&) = delete;
 	file_reader& operator=(file_reader&& n) {
+		std::swap(filename, n.filename);
 		std::swap(f, n.f);
+		std::swap(file_size, n.file_size);
 		return *this;
 	}
 
@@ -233,6 +243,9 @@ struct file_reader {
 		f = fopen(filename.c_str(), "rb");
 		if (!f) error("file_reader: failed to open %s for reading", filename.c_str());
 		this->filename = std::move(filename);
+		fseek(f, 0, SEEK_END);
+		file_size = (size_t)ftell(f);
+		fseek(f, 0, SEEK_SET);
 	}
 
 	void get_bytes(uint8_t* dst, size_t n) {
@@ -280,12 +293,8 @@ struct file_reader {
 		return (size_t)ftell(f);
 	}
 
-	size_t size() {
-		auto prev_pos = ftell(f);
-		fseek(f, 0, SEEK_END);
-		auto r = ftell(f);
-		fseek(f, prev_pos, SEEK_SET);
-		return r;
+	size_t size() const {
+		return file_size;
 	}
 
 };
@@ -448,212 +457,107 @@ auto make_bit_reader(base_reader_T& reader) {
 	return bit_reader<base_reader_T, little_endian>(reader);
 }
 
+// The codes of the PKWARE DCL implode format, which decompress reads and
+// compress (replay_saver.h) writes, least significant bit first.
+// A match length - 2 is one of 16 codes followed by extra bits that are added
+// to the base length of the code. The high bits of a match distance are one of
+// 64 codes, followed by the low 2 bits of the distance for matches of length 2
+// and the low distance_bits bits for longer ones.
+static const uint8_t implode_length_code_bits[16] = {3, 2, 3, 3, 4, 4, 4, 5, 5, 5, 5, 6, 6, 6, 7, 7};
+static const uint8_t implode_length_codes[16] = {0x05, 0x03, 0x01, 0x06, 0x0a, 0x02, 0x0c, 0x14, 0x04, 0x18, 0x08, 0x30, 0x10, 0x20, 0x40, 0x00};
+static const uint8_t implode_length_extra_bits[16] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 2, 3, 4, 5, 6, 7, 8};
+static const uint16_t implode_length_base[16] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 10, 14, 22, 38, 70, 134, 262};
+static const uint8_t implode_distance_code_bits[64] = {
+	2, 4, 4, 5, 5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+	7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8
+};
+static const uint8_t implode_distance_codes[64] = {
+	0x03, 0x0d, 0x05, 0x19, 0x09, 0x11, 0x01, 0x3e, 0x1e, 0x2e, 0x0e, 0x36, 0x16, 0x26, 0x06, 0x3a,
+	0x1a, 0x2a, 0x0a, 0x32, 0x12, 0x22, 0x42, 0x02, 0x7c, 0x3c, 0x5c, 0x1c, 0x6c, 0x2c, 0x4c, 0x0c,
+	0x74, 0x34, 0x54, 0x14, 0x64, 0x24, 0x44, 0x04, 0x78, 0x38, 0x58, 0x18, 0x68, 0x28, 0x48, 0x08,
+	0xf0, 0x70, 0xb0, 0x30, 0xd0, 0x50, 0x90, 0x10, 0xe0, 0x60, 0xa0, 0x20, 0xc0, 0x40, 0x80, 0x00
+};
+
+// The length and distance code that the next 8 bits of input start with.
+struct implode_decode_tables {
+	std::array<uint8_t, 256> length_code;
+	std::array<uint8_t, 256> distance_code;
+	implode_decode_tables() {
+		for (size_t i = 0; i != 16; ++i) {
+			for (size_t v = implode_length_codes[i]; v < 256; v += (size_t)1 << implode_length_code_bits[i]) length_code[v] = (uint8_t)i;
+		}
+		for (size_t i = 0; i != 64; ++i) {
+			for (size_t v = implode_distance_codes[i]; v < 256; v += (size_t)1 << implode_distance_code_bits[i]) distance_code[v] = (uint8_t)i;
+		}
+	}
+};
+
+static inline const implode_decode_tables& get_implode_decode_tables() {
+	static const implode_decode_tables tables;
+	return tables;
+}
+
 template<bool little_endian = true>
 void decompress(uint8_t* input, size_t input_size, uint8_t* output, size_t output_size) {
-	data_reader<little_endian> source_r(input, input + input_size);
-	auto r = make_bit_reader(source_r);
-	int type = r.template get<uint8_t>();
-	int distance_bits = r.template get<uint8_t>();
+	if (input_size < 2) error("decompress: attempt to read past end");
+	int type = input[0];
+	int distance_bits = input[1];
 
 	if (distance_bits != 4 && distance_bits != 5 && distance_bits != 6) error("decompress: invalid distance bits %d", distance_bits);
 
-	auto get_length = [&]() {
-		switch (r.template get_bits<2>()) {
-		case 3: return 1;
-		case 0:
-			switch (r.template get_bits<2>()) {
-			case 3: return 6;
-			case 0:
-				switch (r.template get_bits<6>()) {
-				case 3: return 22;
-				case 7: return 23;
-				case 11: return 24;
-				case 15: return 25;
-				case 19: return 26;
-				case 23: return 27;
-				case 27: return 28;
-				case 31: return 29;
-				case 35: return 30;
-				case 39: return 31;
-				case 43: return 32;
-				case 47: return 33;
-				case 51: return 34;
-				case 55: return 35;
-				case 59: return 36;
-				case 63: return 37;
-				case 0: return 262 + 8 * r.template get_bits<5>();
-				case 1: return r.template get_bits<1>() ? 54 : 38;
-				case 2: return 70 + 16 * r.template get_bits<2>();
-				case 4: return 134 + 8 * r.template get_bits<4>();
-				case 5: return r.template get_bits<1>() ? 55 : 39;
-				case 6: return 71 + 16 * r.template get_bits<2>();
-				case 8: return 263 + 8 * r.template get_bits<5>();
-				case 9: return r.template get_bits<1>() ? 56 : 40;
-				case 10: return 72 + 16 * r.template get_bits<2>();
-				case 12: return 135 + 8 * r.template get_bits<4>();
-				case 13: return r.template get_bits<1>() ? 57 : 41;
-				case 14: return 73 + 16 * r.template get_bits<2>();
-				case 16: return 264 + 8 * r.template get_bits<5>();
-				case 17: return r.template get_bits<1>() ? 58 : 42;
-				case 18: return 74 + 16 * r.template get_bits<2>();
-				case 20: return 136 + 8 * r.template get_bits<4>();
-				case 21: return r.template get_bits<1>() ? 59 : 43;
-				case 22: return 75 + 16 * r.template get_bits<2>();
-				case 24: return 265 + 8 * r.template get_bits<5>();
-				case 25: return r.template get_bits<1>() ? 60 : 44;
-				case 26: return 76 + 16 * r.template get_bits<2>();
-				case 28: return 137 + 8 * r.template get_bits<4>();
-				case 29: return r.template get_bits<1>() ? 61 : 45;
-				case 30: return 77 + 16 * r.template get_bits<2>();
-				case 32: return 266 + 8 * r.template get_bits<5>();
-				case 33: return r.template get_bits<1>() ? 62 : 46;
-				case 34: return 78 + 16 * r.template get_bits<2>();
-				case 36: return 138 + 8 * r.template get_bits<4>();
-				case 37: return r.template get_bits<1>() ? 63 : 47;
-				case 38: return 79 + 16 * r.template get_bits<2>();
-				case 40: return 267 + 8 * r.template get_bits<5>();
-				case 41: return r.template get_bits<1>() ? 64 : 48;
-				case 42: return 80 + 16 * r.template get_bits<2>();
-				case 44: return 139 + 8 * r.template get_bits<4>();
-				case 45: return r.template get_bits<1>() ? 65 : 49;
-				case 46: return 81 + 16 * r.template get_bits<2>();
-				case 48: return 268 + 8 * r.template get_bits<5>();
-				case 49: return r.template get_bits<1>() ? 66 : 50;
-				case 50: return 82 + 16 * r.template get_bits<2>();
-				case 52: return 140 + 8 * r.template get_bits<4>();
-				case 53: return r.template get_bits<1>() ? 67 : 51;
-				case 54: return 83 + 16 * r.template get_bits<2>();
-				case 56: return 269 + 8 * r.template get_bits<5>();
-				case 57: return r.template get_bits<1>() ? 68 : 52;
-				case 58: return 84 + 16 * r.template get_bits<2>();
-				case 60: return 141 + 8 * r.template get_bits<4>();
-				case 61: return r.template get_bits<1>() ? 69 : 53;
-				case 62: return 85 + 16 * r.template get_bits<2>();
-				}
-			case 1:
-				switch (r.template get_bits<1>()) {
-				case 1: return 7;
-				case 0: return r.template get_bits<1>() ? 9 : 8;
-				}
-			case 2:
-				switch (r.template get_bits<3>()) {
-				case 1: return 10;
-				case 3: return 11;
-				case 5: return 12;
-				case 7: return 13;
-				case 0: return r.template get_bits<1>() ? 18 : 14;
-				case 2: return r.template get_bits<1>() ? 19 : 15;
-				case 4: return r.template get_bits<1>() ? 20 : 16;
-				case 6: return r.template get_bits<1>() ? 21 : 17;
-				}
-			}
-		case 1: return r.template get_bits<1>() ? 0 : 2;
-		case 2:
-			switch (r.template get_bits<1>()) {
-			case 1: return 3;
-			case 0: return r.template get_bits<1>() ? 4 : 5;
-			}
-		}
-		return -1;
-	};
+	auto& tables = get_implode_decode_tables();
 
-	auto get_distance = [&]() {
-		switch (r.template get_bits<2>()) {
-		case 3: return 0;
-		case 0:
-			switch (r.template get_bits<5>()) {
-			case 1: return 39;
-			case 2: return 47;
-			case 3: return 31;
-			case 5: return 35;
-			case 6: return 43;
-			case 7: return 27;
-			case 9: return 37;
-			case 10: return 45;
-			case 11: return 29;
-			case 13: return 33;
-			case 14: return 41;
-			case 15: return 25;
-			case 17: return 38;
-			case 18: return 46;
-			case 19: return 30;
-			case 21: return 34;
-			case 22: return 42;
-			case 23: return 26;
-			case 25: return 36;
-			case 26: return 44;
-			case 27: return 28;
-			case 29: return 32;
-			case 30: return 40;
-			case 31: return 24;
-			case 0: return r.template get_bits<1>() ? 62 : 63;
-			case 4: return r.template get_bits<1>() ? 54 : 55;
-			case 8: return r.template get_bits<1>() ? 58 : 59;
-			case 12: return r.template get_bits<1>() ? 50 : 51;
-			case 16: return r.template get_bits<1>() ? 60 : 61;
-			case 20: return r.template get_bits<1>() ? 52 : 53;
-			case 24: return r.template get_bits<1>() ? 56 : 57;
-			case 28: return r.template get_bits<1>() ? 48 : 49;
-			}
-		case 1:
-			switch (r.template get_bits<2>()) {
-			case 1: return 2;
-			case 3: return 1;
-			case 0: return r.template get_bits<1>() ? 5 : 6;
-			case 2: return r.template get_bits<1>() ? 3 : 4;
-			}
-		case 2:
-			switch (r.template get_bits<4>()) {
-			case 1: return 14;
-			case 2: return 18;
-			case 3: return 10;
-			case 4: return 20;
-			case 5: return 12;
-			case 6: return 16;
-			case 7: return 8;
-			case 8: return 21;
-			case 9: return 13;
-			case 10: return 17;
-			case 11: return 9;
-			case 12: return 19;
-			case 13: return 11;
-			case 14: return 15;
-			case 15: return 7;
-			case 0: return r.template get_bits<1>() ? 22 : 23;
+	// The next bits_n bits of input are the low bits of bits. Refilling takes
+	// whole bytes while there is room, 8 at a time when there are that many
+	// left; the bits above bits_n may already hold the start of the next
+	// bytes, which or-ing them in again leaves as is.
+	const uint8_t* in = input + 2;
+	const uint8_t* in_end = input + input_size;
+	uint64_t bits = 0;
+	size_t bits_n = 0;
+	auto refill = [&]() {
+		if (in_end - in >= 8) {
+			bits |= value_at<uint64_t, true>(in) << bits_n;
+			size_t n = (63 - bits_n) / 8;
+			in += n;
+			bits_n += n * 8;
+		} else {
+			for (; bits_n <= 56 && in != in_end; ++in, bits_n += 8) {
+				bits |= (uint64_t)*in << bits_n;
 			}
 		}
-		return -1;
 	};
-
+	auto get_bits = [&](size_t n) {
+		if (bits_n < n) error("decompress: attempt to read past end");
+		size_t r = (size_t)bits & (((size_t)1 << n) - 1);
+		bits >>= n;
+		bits_n -= n;
+		return r;
+	};
 
 	size_t out_pos = 0;
 
 	if (type == 0) {
 
 		while (out_pos != output_size) {
-			if (r.template get_bits<1>()) {
+			// A match is at most 1 + 7 + 8 + 8 + 6 bits.
+			if (bits_n < 30) refill();
+			if (get_bits(1)) {
 
-				size_t len = 2 + get_length();
-				size_t distance = 0;
+				size_t length_code = tables.length_code[bits & 0xff];
+				get_bits(implode_length_code_bits[length_code]);
+				size_t len = 2 + implode_length_base[length_code] + get_bits(implode_length_extra_bits[length_code]);
 
 				if (len == 519) error("decompress: eof marker found too early");
 
-				if (len == 2) {
-					distance = get_distance() << 2;
-					distance |= r.template get_bits<2>();
-				} else {
-					distance = get_distance() << distance_bits;
-					if (distance_bits == 4) distance |= r.template get_bits<4>();
-					else if (distance_bits == 5) distance |= r.template get_bits<5>();
-					else distance |= r.template get_bits<6>();
-				}
+				size_t distance_code = tables.distance_code[bits & 0xff];
+				get_bits(implode_distance_code_bits[distance_code]);
+				size_t distance;
+				if (len == 2) distance = distance_code << 2 | get_bits(2);
+				else distance = distance_code << distance_bits | get_bits(distance_bits);
+
+				if (distance >= out_pos) error("decompress: match distance %d out of range at offset %d", distance + 1, out_pos);
 				size_t src_pos = out_pos - 1 - distance;
-				if (src_pos > output_size) {
-					len = 0;
-				}
-				if (src_pos + len > output_size) {
-					len = output_size - src_pos;
-				}
 				if (out_pos + len > output_size) {
 					len = output_size - out_pos;
 				}
@@ -663,7 +567,7 @@ void decompress(uint8_t* input, size_t input_size, uint8_t* output, size_t outpu
 				out_pos += len;
 
 			} else {
-				output[out_pos] = r.template get<uint8_t>();
+				output[out_pos] = (uint8_t)get_bits(8);
 				++out_pos;
 			}
 		}
@@ -1034,6 +938,13 @@ struct block_table_entry {
 	uint32_t flags;
 };
 
+// Readers over data in memory, like data_reader, which can return a pointer to
+// the next n bytes with get_n instead of copying them.
+template<typename T, typename = void>
+struct is_memory_reader : std::false_type {};
+template<typename T>
+struct is_memory_reader<T, decltype((void)std::declval<T&>().get_n(0))> : std::true_type {};
+
 template<typename base_reader_T, bool default_little_endian = true>
 struct mpq_archive_file_reader {
 	a_string filename;
@@ -1045,7 +956,11 @@ struct mpq_archive_file_reader {
 	a_vector<size_t> compressed_sectors;
 	size_t current_sector = ~(size_t)0;
 	a_vector<uint8_t> compressed_data;
+	a_vector<uint8_t> work_data;
 	a_vector<uint8_t> sector_data;
+	// The data of current_sector; either sector_data or, for sectors stored
+	// as is in an archive in memory, the archive data itself.
+	const uint8_t* sector = nullptr;
 	size_t file_position = 0;
 	mpq_archive_file_reader(a_string arg_filename, base_reader_T& r, size_t sector_size, block_table_entry be, uint32_t key, const crypt_table_t& crypt_table) : filename(std::move(arg_filename)), r(r), sector_size(sector_size), be(be), key(key), crypt_table(crypt_table) {
 
@@ -1074,61 +989,150 @@ struct mpq_archive_file_reader {
 	void read_sector() {
 		current_sector = file_position / sector_size;
 		if (current_sector >= compressed_sectors.size() - 1) error("mpq: %s: attempt to read past end", filename);
-
-		size_t sector_data_size = compressed_sectors[current_sector + 1] - compressed_sectors[current_sector];
 		r.seek(be.data_offset + compressed_sectors[current_sector]);
+		sector = decode_sector(r, current_sector, sector_data.data(), compressed_data, work_data);
+	}
+
+	// The size of sector index once decoded; sector_size for all but the last.
+	size_t decoded_sector_size(size_t index) const {
+		size_t n = be.size - index * sector_size;
+		return n < sector_size ? n : sector_size;
+	}
+
+	// Decodes sector index, read from sector_r, which must be at the start of
+	// the stored sector. out must have room for decoded_sector_size(index)
+	// bytes. compressed and work are scratch buffers for the stages of
+	// decompression. Returns a pointer to the decoded data, which is out unless
+	// the sector is stored as is and sector_r can return it in place.
+	template<typename reader_T>
+	const uint8_t* decode_sector(reader_T& sector_r, size_t index, uint8_t* out, a_vector<uint8_t>& compressed, a_vector<uint8_t>& work) const {
+		size_t sector_data_size = compressed_sectors[index + 1] - compressed_sectors[index];
+		size_t current_sector_size = decoded_sector_size(index);
+
+		if (sector_data_size == current_sector_size && sector_data_size <= sector_size) {
+			if (be.flags & 0x10000) {
+				make_encrypted_reader(sector_r, sector_data_size, key + (uint32_t)index, crypt_table).get_bytes(out, sector_data_size);
+				return out;
+			}
+			return get_stored_sector(sector_r, out, sector_data_size);
+		}
 
 		int compression_flags;
 		auto get_data = [&](auto&& sector_data_r) {
+			if (compressed.size() < sector_data_size) compressed.resize(sector_data_size);
 			if (~be.flags & 0x200) {
 				compression_flags = 8;
-				if (compressed_data.size() < sector_data_size) compressed_data.resize(sector_data_size);
-				sector_data_r.get_bytes(compressed_data.data(), sector_data_size);
+				sector_data_r.get_bytes(compressed.data(), sector_data_size);
 			} else {
 				compression_flags = sector_data_r.template get<uint8_t>();
-	
-				if (compressed_data.size() < sector_data_size) compressed_data.resize(sector_data_size);
-				sector_data_r.get_bytes(compressed_data.data(), sector_data_size - 1);
+				sector_data_r.get_bytes(compressed.data(), sector_data_size - 1);
 			}
 		};
+		if (be.flags & 0x10000) get_data(make_encrypted_reader(sector_r, sector_data_size, key + (uint32_t)index, crypt_table));
+		else get_data(sector_r);
 
-		size_t current_sector_size = sector_data.size();
-		if (current_sector == compressed_sectors.size() - 2) current_sector_size = be.size % sector_size;
-
-		if (sector_data_size == current_sector_size && sector_data_size <= sector_size) {
-			if (be.flags & 0x10000) make_encrypted_reader(r, sector_data_size, key + (uint32_t)current_sector, crypt_table).get_bytes(sector_data.data(), sector_data_size);
-			else r.get_bytes(sector_data.data(), sector_data_size);
-		} else {
-			if (be.flags & 0x10000) get_data(make_encrypted_reader(r, sector_data_size, key + (uint32_t)current_sector, crypt_table));
-			else get_data(r);
-			if (compression_flags == 8) decompress(compressed_data.data(), sector_data_size, sector_data.data(), current_sector_size);
-			else {
-				size_t input_size = sector_data_size;
-				auto swap_buffers = [&](size_t new_input_size) {
-					input_size = new_input_size;
-					std::swap(compressed_data, sector_data);
-					if (compressed_data.size() < sector_data_size) compressed_data.resize(sector_data_size);
-					if (sector_data.size() < current_sector_size) sector_data.resize(current_sector_size);
-				};
-				if (compression_flags & 1) {
-					compression_flags &= ~1;
-					size_t out_size = decompress_huffman(compressed_data.data(), input_size, sector_data.data(), current_sector_size);
-					if (compression_flags) swap_buffers(out_size);
-				}
-				if (compression_flags & 0x40) {
-					compression_flags &= ~0x40;
-					size_t out_size = decompress_adpcm(compressed_data.data(), input_size, sector_data.data(), current_sector_size, 1);
-					if (compression_flags) swap_buffers(out_size);
-				}
-				if (compression_flags & 0x80) {
-					compression_flags &= ~0x80;
-					size_t out_size = decompress_adpcm(compressed_data.data(), input_size, sector_data.data(), current_sector_size, 2);
-					if (compression_flags) swap_buffers(out_size);
+		if (compression_flags == 8) {
+			decompress(compressed.data(), sector_data_size, out, current_sector_size);
+			return out;
+		}
+		// The last stage decompresses into out, the others into work, which
+		// then becomes the input of the next stage.
+		size_t input_size = sector_data_size;
+		auto stage = [&](int flag, auto&& f) {
+			if (~compression_flags & flag) return;
+			compression_flags &= ~flag;
+			if (!compression_flags) {
+				f(compressed.data(), input_size, out);
+				return;
+			}
+			if (work.size() < current_sector_size) work.resize(current_sector_size);
+			input_size = f(compressed.data(), input_size, work.data());
+			std::swap(compressed, work);
+		};
+		stage(1, [&](uint8_t* input, size_t n, uint8_t* output) {
+			return decompress_huffman(input, n, output, current_sector_size);
+		});
+		stage(0x40, [&](uint8_t* input, size_t n, uint8_t* output) {
+			return decompress_adpcm(input, n, output, current_sector_size, 1);
+		});
+		stage(0x80, [&](uint8_t* input, size_t n, uint8_t* output) {
+			return decompress_adpcm(input, n, output, current_sector_size, 2);
+		});
+		if (compression_flags != 0) error("mpq: %s: unsupported compression flags %d", filename, compression_flags);
+		return out;
+	}
+
+	template<typename reader_T, typename std::enable_if<is_memory_reader<reader_T>::value>::type* = nullptr>
+	static const uint8_t* get_stored_sector(reader_T& r, uint8_t* out, size_t n) {
+		return r.get_n(n);
+	}
+	template<typename reader_T, typename std::enable_if<!is_memory_reader<reader_T>::value>::type* = nullptr>
+	static const uint8_t* get_stored_sector(reader_T& r, uint8_t* out, size_t n) {
+		r.get_bytes(out, n);
+		return out;
+	}
+
+	// Reads the whole file into dst, which must have room for size() bytes,
+	// independently of the position get_bytes reads from.
+	// The stored sectors are read from the archive in one go, then decoded
+	// straight into dst on up to thread_count threads, counting the calling
+	// one. Each thread takes at least min_sectors_per_thread sectors, so small
+	// files are decoded on the calling thread only.
+	void get_all(uint8_t* dst, size_t thread_count = 1) {
+		static const size_t min_sectors_per_thread = 4;
+		size_t sectors = compressed_sectors.size() - 1;
+		if (sectors != (be.size + sector_size - 1) / sector_size) error("mpq: %s: attempt to read past end", filename);
+		for (size_t i = 0; i != sectors; ++i) {
+			if (compressed_sectors[i + 1] < compressed_sectors[i]) error("mpq: %s: invalid sector offsets", filename);
+		}
+		size_t stored_begin = compressed_sectors.front();
+		r.seek(be.data_offset + stored_begin);
+		a_vector<uint8_t> stored_buffer;
+		const uint8_t* stored = get_stored_data(r, stored_buffer, compressed_sectors.back() - stored_begin);
+
+		std::atomic<size_t> next_sector{0};
+		std::mutex error_mut;
+		std::exception_ptr decode_error;
+		auto decode_sectors = [&]() {
+			a_vector<uint8_t> compressed;
+			a_vector<uint8_t> work;
+			try {
+				for (size_t i = next_sector++; i < sectors; i = next_sector++) {
+					data_reader<> sector_r(stored + compressed_sectors[i] - stored_begin, stored + compressed_sectors[i + 1] - stored_begin);
+					uint8_t* out = dst + i * sector_size;
+					const uint8_t* data = decode_sector(sector_r, i, out, compressed, work);
+					if (data != out) memcpy(out, data, decoded_sector_size(i));
 				}
-				if (compression_flags != 0) error("mpq: %s: unsupported compression flags %d", filename, compression_flags);
+			} catch (...) {
+				next_sector = sectors;
+				std::lock_guard<std::mutex> l(error_mut);
+				if (!decode_error) decode_error = std::current_exception();
+			}
+		};
+		thread_count = std::max(std::min(thread_count, sectors / min_sectors_per_thread), (size_t)1);
+		a_vector<std::thread> threads;
+		threads.reserve(thread_count - 1);
+		for (size_t i = 1; i < thread_count; ++i) {
+			try {
+				threads.emplace_back(decode_sectors);
+			} catch (const std::system_error&) {
+				break;
 			}
 		}
+		decode_sectors();
+		for (auto& t : threads) t.join();
+		if (decode_error) std::rethrow_exception(decode_error);
+	}
 
+	template<typename reader_T, typename std::enable_if<is_memory_reader<reader_T>::value>::type* = nullptr>
+	static const uint8_t* get_stored_data(reader_T& r, a_vector<uint8_t>& buffer, size_t n) {
+		return r.get_n(n);
+	}
+	template<typename reader_T, typename std::enable_if<!is_memory_reader<reader_T>::value>::type* = nullptr>
+	static const uint8_t* get_stored_data(reader_T& r, a_vector<uint8_t>& buffer, size_t n) {
+		buffer.resize(n);
+		r.get_bytes(buffer.data(), n);
+		return buffer.data();
 	}
 
 	void get_bytes(uint8_t* dst, size_t n) {
@@ -1137,7 +1141,7 @@ struct mpq_archive_file_reader {
 		size_t sector_offset = file_position % sector_size;
 		while (sector_size - sector_offset < n) {
 			size_t n_read = sector_size - sector_offset;
-			memcpy(dst, &sector_data[sector_offset], n_read);
+			memcpy(dst, sector + sector_offset, n_read);
 			dst += n_read;
 			n -= n_read;
 			file_position += n_read;
@@ -1145,7 +1149,7 @@ struct mpq_archive_file_reader {
 			sector_offset = 0;
 		}
 		if (n && sector_size - sector_offset >= n) {
-			memcpy(dst, &sector_data[sector_offset], n);
+			memcpy(dst, sector + sector_offset, n);
 			file_position += n;
 		}
 	}
@@ -1271,34 +1275,45 @@ auto make_mpq_archive_reader(base_reader_T& reader) {
 struct mpq_data {
 	data_reader<> r;
 	mpq_archive_reader<data_reader<>> mpq;
+	// The number of threads to decompress a file on (see get_all).
+	size_t thread_count = 1;
 	explicit mpq_data(uint8_t* data, size_t data_size) : r(data, data + data_size), mpq(r) {}
 	void operator()(a_vector<uint8_t>& dst, a_string filename) {
 		auto file_r = mpq.open(std::move(filename));
-		size_t len = file_r.size();
-		dst.resize(len);
-		file_r.get_bytes(dst.data(), len);
-		return;
+		dst.resize(file_r.size());
+		file_r.get_all(dst.data(), thread_count);
 	}
 };
 
+// The reader mpq_file reads the archive of a file_reader_T through. Readers of
+// files are paged; file readers that map the file into memory can specialize
+// this to be read directly (see mmap_reader.h).
+template<typename file_reader_T>
+struct mpq_file_reader {
+	using type = paged_reader<file_reader_T>;
+};
+
 template<typename file_reader_T = file_reader<>>
 struct mpq_file {
+	using reader_type = typename mpq_file_reader<file_reader_T>::type;
 	file_reader_T file;
-	paged_reader<file_reader_T> paged;
-	mpq_archive_reader<paged_reader<file_reader_T>> mpq;
+	reader_type paged;
+	mpq_archive_reader<reader_type> mpq;
+	// The number of threads to decompress a file on (see get_all).
+	size_t thread_count = 1;
 	explicit mpq_file(a_string filename) : file(std::move(filename)), paged(file), mpq(paged) {}
 	void operator()(a_vector<uint8_t>& dst, a_string filename) {
 		auto file_r = mpq.open(std::move(filename));
-		size_t len = file_r.size();
-		dst.resize(len);
-		file_r.get_bytes(dst.data(), len);
-		return;
+		dst.resize(file_r.size());
+		file_r.get_all(dst.data(), thread_count);
 	}
 };
 
 template<typename mpq_file_T = mpq_file<>>
 struct data_files_loader {
 	a_list<mpq_file_T> mpqs;
+	// Passed on to the mpq files as their thread_count.
+	size_t thread_count = 1;
 
 	void add_mpq_file(a_string filename) {
 		mpqs.emplace_back(std::move(filename));
@@ -1307,6 +1322,7 @@ struct data_files_loader {
 	void operator()(a_vector<uint8_t>& dst, a_string filename) {
 		for (auto& v : mpqs) {
 			if (v.mpq.file_exists(filename)) {
+				v.thread_count = thread_count;
 				v(dst, std::move(filename));
 				return;
 			}
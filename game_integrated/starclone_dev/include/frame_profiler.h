@@ -0,0 +1,210 @@
+#ifndef BWGAME_FRAME_PROFILER_H
+#define BWGAME_FRAME_PROFILER_H
+
+#include "util.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+
+namespace bwgame {
+
+// Per frame timings of the phases of state_functions::next_frame and counts of
+// the work done in them.
+//
+// The instrumentation is only compiled in when BWGAME_FRAME_PROFILER is
+// defined, otherwise the BWGAME_PROFILE_* macros expand to nothing. To profile,
+// point state_functions::profiler at a frame_profiler; every call to next_frame
+// then adds one sample to each histogram.
+//
+// Each histogram holds the last window_size frames, timings in nanoseconds.
+struct frame_profiler {
+	enum phase_t {
+		phase_frame,
+		phase_recede_creep,
+		phase_update_units,
+		phase_unit_movement,
+		phase_update_unit,
+		phase_update_bullets,
+		phase_update_thingies,
+		phase_process_triggers,
+		phase_count
+	};
+	enum counter_t {
+		counter_units,
+		counter_bullets,
+		counter_thingies,
+		counter_iscript_ops,
+		counter_pathfinder_calls,
+		counter_count
+	};
+
+	static const char* phase_name(phase_t phase) {
+		static const std::array<const char*, phase_count> names = {
+			"frame", "recede_creep", "update_units", "unit_movement", "update_unit", "update_bullets", "update_thingies", "process_triggers"
+		};
+		return names.at(phase);
+	}
+	static const char* counter_name(counter_t counter) {
+		static const std::array<const char*, counter_count> names = {
+			"units", "bullets", "thingies", "iscript_ops", "pathfinder_calls"
+		};
+		return names.at(counter);
+	}
+
+	struct histogram {
+		// Bucket n counts the samples in [2^(n-1), 2^n), bucket 0 counts zeroes.
+		static constexpr size_t bucket_count = 48;
+		std::array<size_t, bucket_count> buckets{};
+		a_vector<uint64_t> window;
+		size_t window_pos = 0;
+		uint64_t sum = 0;
+
+		static size_t bucket(uint64_t v) {
+			size_t r = 0;
+			while (v && r != bucket_count - 1) {
+				v >>= 1;
+				++r;
+			}
+			return r;
+		}
+
+		void add(uint64_t v, size_t window_size) {
+			if (window_size == 0) return;
+			if (window.size() < window_size) {
+				window.push_back(v);
+			} else {
+				uint64_t& old = window[window_pos];
+				--buckets[bucket(old)];
+				sum -= old;
+				old = v;
+				window_pos = (window_pos + 1) % window_size;
+			}
+			++buckets[bucket(v)];
+			sum += v;
+		}
+		size_t samples() const {
+			return window.size();
+		}
+		double mean() const {
+			return window.empty() ? 0.0 : (double)sum / window.size();
+		}
+		uint64_t max() const {
+			return window.empty() ? 0 : *std::max_element(window.begin(), window.end());
+		}
+		uint64_t last() const {
+			if (window.empty()) return 0;
+			return window[(window_pos + window.size() - 1) % window.size()];
+		}
+		// p in [0, 1]
+		uint64_t percentile(double p) const {
+			if (window.empty()) return 0;
+			a_vector<uint64_t> tmp = window;
+			size_t n = std::min((size_t)(p * tmp.size()), tmp.size() - 1);
+			std::nth_element(tmp.begin(), tmp.begin() + n, tmp.end());
+			return tmp[n];
+		}
+	};
+
+	struct scope {
+		frame_profiler* profiler;
+		phase_t phase;
+		std::chrono::steady_clock::time_point start;
+		scope(frame_profiler* profiler, phase_t phase) : profiler(profiler), phase(phase) {
+			if (profiler) start = std::chrono::steady_clock::now();
+		}
+		~scope() {
+			if (!profiler) return;
+			auto t = std::chrono::steady_clock::now() - start;
+			profiler->frame_phases[phase] += std::chrono::duration_cast<std::chrono::nanoseconds>(t).count();
+		}
+		scope(const scope&) = delete;
+		scope& operator=(const scope&) = delete;
+	};
+
+	size_t window_size;
+	std::array<histogram, phase_count> phases;
+	std::array<histogram, counter_count> counters;
+	std::array<uint64_t, phase_count> frame_phases{};
+	std::array<uint64_t, counter_count> frame_counters{};
+	int last_frame = 0;
+	size_t total_frames = 0;
+
+	explicit frame_profiler(size_t window_size = 1024) : window_size(window_size) {}
+
+	void reset(size_t new_window_size) {
+		*this = frame_profiler(new_window_size);
+	}
+
+	void add(counter_t counter, uint64_t n) {
+		frame_counters[counter] += n;
+	}
+
+	void end_frame(int frame) {
+		for (size_t i = 0; i != phase_count; ++i) {
+			phases[i].add(frame_phases[i], window_size);
+			frame_phases[i] = 0;
+		}
+		for (size_t i = 0; i != counter_count; ++i) {
+			counters[i].add(frame_counters[i], window_size);
+			frame_counters[i] = 0;
+		}
+		last_frame = frame;
+		++total_frames;
+	}
+
+	const histogram& phase(phase_t phase) const {
+		return phases.at(phase);
+	}
+	const histogram& counter(counter_t counter) const {
+		return counters.at(counter);
+	}
+
+	template<typename F>
+	void for_each_histogram(F&& f) const {
+		for (size_t i = 0; i != phase_count; ++i) f(phase_name((phase_t)i), "ns", phases[i]);
+		for (size_t i = 0; i != counter_count; ++i) f(counter_name((counter_t)i), "count", counters[i]);
+	}
+
+	// One line per histogram, with the bucket counts in the columns b0..b47.
+	a_string csv() const {
+		a_string r = "name,unit,samples,mean,p50,p90,p99,max";
+		for (size_t i = 0; i != histogram::bucket_count; ++i) r += format(",b%d", i);
+		r += "\n";
+		for_each_histogram([&](const char* name, const char* unit, const histogram& h) {
+			r += format("%s,%s,%d,%.1f,%d,%d,%d,%d", name, unit, h.samples(), h.mean(), h.percentile(0.5), h.percentile(0.9), h.percentile(0.99), h.max());
+			for (size_t v : h.buckets) r += format(",%d", v);
+			r += "\n";
+		});
+		return r;
+	}
+
+	// Buckets are written up to the last non-empty one.
+	a_string json() const {
+		a_string r = format("{\"last_frame\":%d,\"total_frames\":%d,\"window_size\":%d", last_frame, total_frames, window_size);
+		for_each_histogram([&](const char* name, const char* unit, const histogram& h) {
+			r += format(",\"%s\":{\"unit\":\"%s\",\"samples\":%d,\"mean\":%.1f", name, unit, h.samples(), h.mean());
+			r += format(",\"p50\":%d,\"p90\":%d,\"p99\":%d,\"max\":%d,\"buckets\":[", h.percentile(0.5), h.percentile(0.9), h.percentile(0.99), h.max());
+			size_t n = h.buckets.size();
+			while (n && !h.buckets[n - 1]) --n;
+			for (size_t i = 0; i != n; ++i) r += format(i ? ",%d" : "%d", h.buckets[i]);
+			r += "]}";
+		});
+		r += "}";
+		return r;
+	}
+};
+
+}
+
+#ifdef BWGAME_FRAME_PROFILER
+#define BWGAME_PROFILE_PHASE(name) ::bwgame::frame_profiler::scope profile_scope_##name(profiler, ::bwgame::frame_profiler::name)
+#define BWGAME_PROFILE_COUNT(name, n) (profiler ? profiler->add(::bwgame::frame_profiler::name, n) : (void)0)
+#define BWGAME_PROFILE_END_FRAME(frame) (profiler ? profiler->end_frame(frame) : (void)0)
+#else
+#define BWGAME_PROFILE_PHASE(name) ((void)0)
+#define BWGAME_PROFILE_COUNT(name, n) ((void)0)
+#define BWGAME_PROFILE_END_FRAME(frame) ((void)0)
+#endif
+
+#endif
@@ -0,0 +1,148 @@
+#ifndef BWGAME_FRAME_READERS_H
+#define BWGAME_FRAME_READERS_H
+
+#include "bwgame.h"
+
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace bwgame {
+
+// Runs read-only callbacks (bots, stats collectors) on worker threads as the
+// read phase of every frame:
+//
+//   frame_readers readers(4);
+//   readers.add([&](const state& st) { ... });
+//   funcs.read_phase = &readers;
+//
+// Every reader is called once per frame, on one of the workers, in parallel
+// with the other readers. With mode_barrier they read the simulated state
+// itself, and the next frame waits until they are all done. With
+// mode_snapshot they read a copy of the state taken at the end of the frame,
+// so the simulation runs alongside them and only waits at the end of the next
+// frame if they are still not done. Like the staging state of state_snapshots,
+// the copy is only ever copied into, so it keeps its allocations and objects
+// keep their addresses from frame to frame. It is not taken when there are no
+// readers.
+//
+// An exception thrown by a reader is rethrown on the simulation thread the
+// next time it waits for the readers. With no threads, the readers run on the
+// simulation thread in begin.
+struct frame_readers : frame_read_phase {
+	enum mode_t {
+		mode_barrier,
+		mode_snapshot
+	};
+
+	explicit frame_readers(size_t thread_count, mode_t mode = mode_barrier) : mode(mode) {
+		for (size_t i = 0; i != thread_count; ++i) {
+			threads.emplace_back([this]() {
+				worker();
+			});
+		}
+	}
+	frame_readers(const frame_readers&) = delete;
+	frame_readers& operator=(const frame_readers&) = delete;
+	~frame_readers() {
+		{
+			std::unique_lock<std::mutex> l(mut);
+			done_cv.wait(l, [&]() {
+				return pending == 0;
+			});
+			quit = true;
+		}
+		work_cv.notify_all();
+		for (auto& t : threads) t.join();
+	}
+
+	void add(std::function<void(const state&)> reader) {
+		wait();
+		std::lock_guard<std::mutex> l(mut);
+		readers.push_back(std::move(reader));
+		next_reader = readers.size();
+	}
+
+	virtual void begin(const state& st) override {
+		if (readers.empty()) return;
+		const state* reader_st = &st;
+		if (mode == mode_snapshot) {
+			wait();
+			state_copier(st, snapshot)();
+			reader_st = &snapshot;
+		}
+		if (threads.empty()) {
+			for (auto& f : readers) f(*reader_st);
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> l(mut);
+			current_st = reader_st;
+			next_reader = 0;
+			pending = readers.size();
+		}
+		work_cv.notify_all();
+	}
+
+	virtual void end() override {
+		if (mode == mode_barrier) wait();
+	}
+
+	// Waits until the readers of the last frame are done.
+	void wait() {
+		std::unique_lock<std::mutex> l(mut);
+		done_cv.wait(l, [&]() {
+			return pending == 0;
+		});
+		if (reader_error) {
+			std::exception_ptr e = reader_error;
+			reader_error = nullptr;
+			std::rethrow_exception(e);
+		}
+	}
+
+private:
+	mode_t mode;
+	a_vector<std::function<void(const state&)>> readers;
+	a_vector<std::thread> threads;
+	state snapshot;
+
+	std::mutex mut;
+	std::condition_variable work_cv;
+	std::condition_variable done_cv;
+	const state* current_st = nullptr;
+	// The readers of the current frame that have not been started are
+	// readers[next_reader..].
+	size_t next_reader = 0;
+	size_t pending = 0;
+	bool quit = false;
+	std::exception_ptr reader_error;
+
+	void worker() {
+		std::unique_lock<std::mutex> l(mut);
+		while (true) {
+			work_cv.wait(l, [&]() {
+				return quit || next_reader != readers.size();
+			});
+			if (quit) return;
+			auto& f = readers[next_reader++];
+			const state& st = *current_st;
+			l.unlock();
+			std::exception_ptr e;
+			try {
+				f(st);
+			} catch (...) {
+				e = std::current_exception();
+			}
+			l.lock();
+			if (e && !reader_error) reader_error = e;
+			if (--pending == 0) done_cv.notify_all();
+		}
+	}
+};
+
+}
+
+#endif
@@ -5,6 +5,9 @@
 #include "data_types.h"
 #include "containers.h"
 
+#include <memory>
+#include <mutex>
+
 namespace bwgame {
 
 struct sprite_t;
@@ -270,9 +273,6 @@ struct regions_t {
 		a_vector<region*> walkable_neighbors;
 		a_vector<region*> non_walkable_neighbors;
 
-		mutable int pathfinder_flag = 0; // fixme: remove
-		mutable void* pathfinder_node = nullptr; // fixme: remove
-
 		bool walkable() const {
 			return flags != 0x1ffd;
 		}
@@ -304,6 +304,37 @@ struct regions_t {
 
 	std::array<a_vector<contour>, 4> contours;
 
+	// Walking distances between the centers of walkable regions from each of
+	// the landmark regions to every region, indexed by region::index. They
+	// give lower bounds on the distance between any two regions, see
+	// state_functions::region_distance_lower_bound. generation is incremented
+	// whenever they are rebuilt.
+	a_vector<size_t> landmarks;
+	a_vector<a_vector<int>> landmark_distances;
+	size_t generation = 0;
+
+	// Flow fields by destination tile index, most recently used last, see
+	// state_functions::flow_field_to. They only depend on the regions, so they
+	// are shared by every state using this game_state and are cleared when
+	// generation changes. Copies start out empty.
+	struct flow_field_cache_t {
+		std::mutex mut;
+		size_t generation = ~(size_t)0;
+		size_t max_fields = 32;
+		a_vector<std::pair<size_t, std::shared_ptr<const a_vector<uint8_t>>>> fields;
+
+		flow_field_cache_t() = default;
+		flow_field_cache_t(const flow_field_cache_t& n) : max_fields(n.max_fields) {}
+		flow_field_cache_t& operator=(const flow_field_cache_t& n) {
+			std::lock_guard<std::mutex> l(mut);
+			generation = ~(size_t)0;
+			max_fields = n.max_fields;
+			fields.clear();
+			return *this;
+		}
+	};
+	mutable flow_field_cache_t flow_field_cache;
+
 };
 
 struct creep_life_t {
@@ -767,8 +798,13 @@ struct unit_t: flingy_t {
 
 	rect unit_finder_bounding_box;
 	std::array<bool, 4> unit_finder_visited;
+#ifdef BWGAME_GRID_UNIT_FINDER
+	std::array<int64_t, 4> unit_finder_order;
+#endif
 	size_t unit_finder_index_from;
 	size_t unit_finder_index_to;
+
+	uint64_t sync_hash;
 };
 
 }
@@ -0,0 +1,125 @@
+#ifndef BWGAME_MMAP_READER_H
+#define BWGAME_MMAP_READER_H
+
+#include "data_loading.h"
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace bwgame {
+namespace data_loading {
+
+// A data_reader over a read-only memory mapping of a file.
+//
+// With mpq_file<mmap_reader>, the archive header and tables are parsed
+// straight from the mapping and sectors that are stored uncompressed and
+// unencrypted are read from it without being copied into a sector buffer.
+struct mmap_reader : data_reader<> {
+	a_string filename;
+	mmap_reader() = default;
+	explicit mmap_reader(a_string filename) {
+		open(std::move(filename));
+	}
+	~mmap_reader() {
+		close();
+	}
+	mmap_reader(const mmap_reader&) = delete;
+	mmap_reader(mmap_reader&& n) {
+		*this = std::move(n);
+	}
+	mmap_reader& operator=(const mmap_reader&) = delete;
+	mmap_reader& operator=(mmap_reader&& n) {
+		std::swap((data_reader<>&)*this, (data_reader<>&)n);
+		std::swap(filename, n.filename);
+#ifdef _WIN32
+		std::swap(file, n.file);
+		std::swap(mapping, n.mapping);
+#endif
+		return *this;
+	}
+
+	void open(a_string filename) {
+		close();
+		size_t size = 0;
+		const uint8_t* data = nullptr;
+#ifdef _WIN32
+		file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE) error("mmap_reader: failed to open %s for reading", filename.c_str());
+		LARGE_INTEGER file_size;
+		if (!GetFileSizeEx(file, &file_size)) {
+			close();
+			error("mmap_reader: %s: failed to get file size", filename.c_str());
+		}
+		size = (size_t)file_size.QuadPart;
+		if (size) {
+			mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			if (mapping) data = (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+			if (!data) {
+				close();
+				error("mmap_reader: %s: failed to map file", filename.c_str());
+			}
+		}
+#else
+		int fd = ::open(filename.c_str(), O_RDONLY);
+		if (fd == -1) error("mmap_reader: failed to open %s for reading", filename.c_str());
+		struct stat st;
+		if (fstat(fd, &st)) {
+			::close(fd);
+			error("mmap_reader: %s: failed to get file size", filename.c_str());
+		}
+		size = (size_t)st.st_size;
+		if (size) {
+			void* p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (p == MAP_FAILED) {
+				::close(fd);
+				error("mmap_reader: %s: failed to map file", filename.c_str());
+			}
+			data = (const uint8_t*)p;
+		}
+		::close(fd);
+#endif
+		(data_reader<>&)*this = data_reader<>(data, data + size);
+		this->filename = std::move(filename);
+	}
+
+	void close() {
+#ifdef _WIN32
+		if (begin) UnmapViewOfFile(begin);
+		if (mapping) CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+		mapping = nullptr;
+		file = INVALID_HANDLE_VALUE;
+#else
+		if (begin) munmap((void*)begin, size());
+#endif
+		(data_reader<>&)*this = data_reader<>();
+	}
+
+private:
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = nullptr;
+#endif
+};
+
+template<>
+struct mpq_file_reader<mmap_reader> {
+	using type = data_reader<>;
+};
+
+}
+}
+
+#endif
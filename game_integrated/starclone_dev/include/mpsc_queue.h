@@ -0,0 +1,98 @@
+#ifndef BWGAME_MPSC_QUEUE_H
+#define BWGAME_MPSC_QUEUE_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+namespace bwgame {
+
+// Bounded lock-free queue with any number of producer threads and a single
+// consumer thread. try_push fails instead of blocking when the queue is full.
+//
+// Each cell holds a sequence number that says whose turn it is: a producer
+// claims position pos by advancing push_pos when the cell's sequence is pos,
+// writes the value and publishes it by setting the sequence to pos + 1; the
+// consumer takes it when the sequence is pos + 1 and hands the cell back to
+// the producers of the next lap by setting it to pos + capacity.
+// A producer that has claimed a cell but not yet published it holds up the
+// values behind it until it does.
+//
+// The callbacks may throw. A cell whose write threw is still published, so
+// the values behind it are not held up, but marked empty and skipped by
+// try_pop. A value whose read threw is removed all the same.
+template<typename T, size_t capacity>
+struct mpsc_queue {
+	static_assert(capacity != 0 && (capacity & (capacity - 1)) == 0, "mpsc_queue capacity must be a power of two");
+
+	mpsc_queue() {
+		for (size_t i = 0; i != capacity; ++i) cells[i].sequence.store(i, std::memory_order_relaxed);
+	}
+	mpsc_queue(const mpsc_queue&) = delete;
+	mpsc_queue& operator=(const mpsc_queue&) = delete;
+
+	// Any thread. write is called with the T to fill in, unless the queue is
+	// full, in which case this returns false.
+	template<typename F>
+	bool try_push(F&& write) {
+		size_t pos = push_pos.load(std::memory_order_relaxed);
+		while (true) {
+			cell& c = cells[pos % capacity];
+			size_t seq = c.sequence.load(std::memory_order_acquire);
+			if (seq == pos) {
+				if (push_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					struct publish_guard {
+						cell& c;
+						size_t sequence;
+						~publish_guard() {
+							c.sequence.store(sequence, std::memory_order_release);
+						}
+					} guard{c, pos + 1};
+					c.has_value = false;
+					write(c.value);
+					c.has_value = true;
+					return true;
+				}
+			} else if ((ptrdiff_t)(seq - pos) < 0) {
+				return false;
+			} else {
+				pos = push_pos.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	// Consumer thread only. Calls read with the oldest published value and
+	// removes it, or returns false if there is none.
+	template<typename F>
+	bool try_pop(F&& read) {
+		while (true) {
+			cell& c = cells[pop_pos % capacity];
+			if (c.sequence.load(std::memory_order_acquire) != pop_pos + 1) return false;
+			struct release_guard {
+				mpsc_queue& q;
+				cell& c;
+				~release_guard() {
+					c.sequence.store(q.pop_pos + capacity, std::memory_order_release);
+					++q.pop_pos;
+				}
+			} guard{*this, c};
+			if (!c.has_value) continue;
+			read(c.value);
+			return true;
+		}
+	}
+
+private:
+	struct cell {
+		std::atomic<size_t> sequence;
+		bool has_value = false;
+		T value;
+	};
+	std::array<cell, capacity> cells;
+	alignas(64) std::atomic<size_t> push_pos{0};
+	alignas(64) size_t pop_pos = 0;
+};
+
+}
+
+#endif
@@ -5,6 +5,7 @@
 #include "data_loading.h"
 #include "korean.h"
 #include "bwgame.h"
+#include "state_snapshots.h"
 
 namespace bwgame {
 
@@ -81,8 +82,128 @@ auto make_replay_file_reader(base_reader_T& reader) {
 
 }
 
+// Index of the actions in the action stream of a replay, for looking them up
+// by frame, player or action id without executing them or reading the stream
+// from the start:
+//
+//   for (auto& a : replay_st.action_index.player_actions_between(owner, 10000, 12000)) {
+//     if (a.action_id == 12) ... // build
+//   }
+//
+// The stream is indexed up to the first action that can not be read; a valid
+// replay is indexed in full (indexed_size is the size of the stream). Actions
+// are in stream order, which is frame order in a valid replay.
+struct replay_action_index {
+	struct action_t {
+		int frame;
+		// The player slot, as for action_functions::read_action.
+		int owner;
+		int action_id;
+		// The offset of the action (its player id) in the stream and its size,
+		// including the player id and action id.
+		size_t offset;
+		size_t size;
+	};
+	struct frame_t {
+		int frame;
+		// The offset of the actions of the frame in the stream.
+		size_t offset;
+		size_t first_action;
+	};
+	a_vector<action_t> actions;
+	a_vector<frame_t> frames;
+	// Indices into actions of the actions of every player slot and every action id.
+	std::array<a_vector<size_t>, 12> player_action_indices;
+	std::array<a_vector<size_t>, 256> action_id_indices;
+	size_t indexed_size = 0;
+
+	void clear() {
+		actions.clear();
+		frames.clear();
+		for (auto& v : player_action_indices) v.clear();
+		for (auto& v : action_id_indices) v.clear();
+		indexed_size = 0;
+	}
+
+	void build(const uint8_t* data, size_t data_size, const std::array<int, 12>& player_id) {
+		clear();
+		size_t pos = 0;
+		while (data_size - pos >= 5) {
+			int frame = data_loading::value_at<int32_t, true>(data + pos);
+			size_t end = pos + 5 + data[pos + 4];
+			if (end > data_size) break;
+			size_t first_action = actions.size();
+			size_t action_pos = pos + 5;
+			while (action_pos != end) {
+				if (end - action_pos < 2) break;
+				auto i = std::find(player_id.begin(), player_id.end(), (int)data[action_pos]);
+				if (i == player_id.end()) break;
+				int action_id = data[action_pos + 1];
+				size_t n = action_data_size(action_id, data + action_pos + 2, end - action_pos - 2);
+				if (n == ~(size_t)0) break;
+				actions.push_back({frame, (int)(i - player_id.begin()), action_id, action_pos, 2 + n});
+				action_pos += 2 + n;
+			}
+			if (action_pos != end) {
+				actions.resize(first_action);
+				break;
+			}
+			frames.push_back({frame, pos, first_action});
+			pos = end;
+		}
+		indexed_size = pos;
+		for (size_t i = 0; i != actions.size(); ++i) {
+			player_action_indices[actions[i].owner].push_back(i);
+			action_id_indices[actions[i].action_id].push_back(i);
+		}
+	}
+
+	// The index of the first action at or after frame.
+	size_t first_action(int frame) const {
+		auto i = std::lower_bound(frames.begin(), frames.end(), frame, [](const frame_t& a, int frame) {
+			return a.frame < frame;
+		});
+		return i == frames.end() ? actions.size() : i->first_action;
+	}
+
+	// The actions from begin_frame up to, but not including, end_frame.
+	auto actions_between(int begin_frame, int end_frame) const {
+		return make_iterators_range(actions.data() + first_action(begin_frame), actions.data() + first_action(end_frame));
+	}
+
+	// The actions of indices, a sorted list of indices into actions, from
+	// begin_frame up to, but not including, end_frame.
+	auto indexed_actions_between(const a_vector<size_t>& indices, int begin_frame, int end_frame) const {
+		size_t begin = first_action(begin_frame);
+		size_t end = first_action(end_frame);
+		auto range = make_iterators_range(std::lower_bound(indices.begin(), indices.end(), begin), std::lower_bound(indices.begin(), indices.end(), end));
+		return make_transform_range(range, [this](size_t index) -> const action_t& {
+			return actions[index];
+		});
+	}
+
+	auto player_actions_between(int owner, int begin_frame, int end_frame) const {
+		return indexed_actions_between(player_action_indices.at(owner), begin_frame, end_frame);
+	}
+
+	auto actions_with_id_between(int action_id, int begin_frame, int end_frame) const {
+		return indexed_actions_between(action_id_indices.at(action_id), begin_frame, end_frame);
+	}
+
+	// Makes action_functions::execute_actions continue from the first actions
+	// at or after frame, as if the actions before it had been executed.
+	void seek(action_state& action_st, int frame) const {
+		auto i = std::lower_bound(frames.begin(), frames.end(), frame, [](const frame_t& a, int frame) {
+			return a.frame < frame;
+		});
+		action_st.actions_data_position = i == frames.end() ? indexed_size : i->offset;
+		action_st.next_action_frame = i == frames.end() ? frame : i->frame;
+	}
+};
+
 struct replay_state {
 	a_vector<uint8_t> actions_data_buffer;
+	replay_action_index action_index;
 	int end_frame = 0;
 	a_string map_name;
 	std::array<a_string, 12> player_name;
@@ -195,6 +316,7 @@ struct replay_functions: action_functions {
 		
 		replay_st.actions_data_buffer.resize(r.template get<uint32_t>());
 		r.get_bytes(replay_st.actions_data_buffer.data(), replay_st.actions_data_buffer.size());
+		replay_st.action_index.build(replay_st.actions_data_buffer.data(), replay_st.actions_data_buffer.size(), action_st.player_id);
 		
 		a_vector<uint8_t> map_buffer;
 		map_buffer.resize(r.template get<uint32_t>());
@@ -232,6 +354,7 @@ struct replay_functions: action_functions {
 	
 	void next_frame() {
 		if (st.current_frame == replay_st.end_frame) error("replay: attempt to play past end");
+		end_read_phase();
 		execute_actions(replay_st.actions_data_buffer.data(), replay_st.actions_data_buffer.data() + replay_st.actions_data_buffer.size());
 		state_functions::next_frame();
 	}
@@ -242,6 +365,100 @@ struct replay_functions: action_functions {
 	
 };
 
+// State snapshots taken every interval frames while a replay is played, so
+// that seeking only has to simulate from the nearest earlier keyframe.
+// Keyframes are state_snapshots deltas against the last full snapshot, and a new
+// full snapshot is taken when a delta grows beyond half of its base.
+// When memory_budget is exceeded the interval is doubled and the keyframes that
+// are now closer than interval to the previous kept one are dropped.
+struct replay_keyframes {
+	struct keyframe {
+		int frame = 0;
+		std::shared_ptr<const state_snapshot> snapshot;
+		action_state action_st;
+	};
+	int interval = 24 * 30;
+	size_t memory_budget = 512 * 1024 * 1024;
+	size_t memory_usage = 0;
+	a_map<int, keyframe> frames;
+	state_snapshots snapshots;
+	std::shared_ptr<const state_snapshot> base;
+	// Set when the last delta was more than half the size of base. Deltas grow
+	// as the state drifts away from base, so the next keyframe starts a new one.
+	bool rebase = false;
+
+	void clear() {
+		frames.clear();
+		base = nullptr;
+		rebase = false;
+		snapshots.clear();
+		memory_usage = 0;
+	}
+
+	// Keyframes are at least interval frames apart, rather than at multiples of
+	// interval, since more than one frame can pass between two calls to save.
+	bool wants(int frame) const {
+		auto i = frames.upper_bound(frame);
+		if (i == frames.begin()) return true;
+		return frame >= std::prev(i)->first + interval;
+	}
+
+	void save(const state& st, const action_state& action_st) {
+		if (!wants(st.current_frame)) return;
+		std::shared_ptr<const state_snapshot> v;
+		if (base && !rebase) {
+			v = snapshots.take(st, base);
+			rebase = v->memory_usage > base->memory_usage / 2;
+		} else {
+			v = snapshots.take(st);
+			base = v;
+			rebase = false;
+		}
+		auto& k = frames[st.current_frame];
+		k.frame = st.current_frame;
+		k.snapshot = std::move(v);
+		k.action_st = copy_state(action_st, st, snapshots.staging);
+		update_memory_usage();
+		while (memory_usage > memory_budget && frames.size() > 1) {
+			interval *= 2;
+			int last = frames.begin()->first;
+			for (auto i = std::next(frames.begin()); i != frames.end();) {
+				if (i->first < last + interval) i = frames.erase(i);
+				else {
+					last = i->first;
+					++i;
+				}
+			}
+			update_memory_usage();
+		}
+	}
+
+	void update_memory_usage() {
+		a_unordered_set<const state_snapshot*> counted;
+		memory_usage = 0;
+		auto add = [&](const state_snapshot* v) {
+			if (v && counted.insert(v).second) memory_usage += v->memory_usage;
+		};
+		add(base.get());
+		for (auto& v : frames) {
+			add(v.second.snapshot.get());
+			add(v.second.snapshot->base.get());
+		}
+	}
+
+	// Returns the last keyframe at or before frame, or null if there is none.
+	const keyframe* find(int frame) const {
+		auto i = frames.upper_bound(frame);
+		if (i == frames.begin()) return nullptr;
+		return &std::prev(i)->second;
+	}
+
+	void restore(const keyframe& v, state& st, action_state& action_st) {
+		st = snapshots.materialize(*v.snapshot);
+		action_st = copy_state(v.action_st, snapshots.staging, st);
+	}
+};
+
 struct replay_player: game_player {
 	action_state action_st;
 	replay_state replay_st;
@@ -0,0 +1,663 @@
+#ifndef BWGAME_STATE_HASH_H
+#define BWGAME_STATE_HASH_H
+
+#include "bwgame.h"
+#include "data_loading.h"
+
+#include <cstdio>
+#include <type_traits>
+
+namespace bwgame {
+
+// Hash of (nearly) all of the simulation state, for finding out exactly what
+// differs between two states that are supposed to be the same.
+//
+// state_functions::sync_hash only covers the fields that are cheap to keep up
+// to date; this walks every live unit, bullet, order, sprite, image and thingy
+// and every tile, so it costs about as much as copying the state. Fields are
+// hashed one by one rather than as the bytes of the object, since padding and
+// the unused parts of unions are not deterministic, and pointers are hashed as
+// the index of the object or the id of the type they point to.
+//
+// Fields that only the ui uses (selection, unit finder and cache fields) are
+// left out.
+//
+// If field_log is set, the name of every field of an object is logged along
+// with the hash so far, which is how diff_objects names the first field that
+// differs between two objects.
+struct state_hasher {
+	struct field_log_entry {
+		const char* name;
+		uint64_t hash;
+	};
+
+	state& st;
+	state_functions funcs;
+	uint64_t r = 0xcbf29ce484222325;
+	a_vector<field_log_entry>* field_log = nullptr;
+
+	explicit state_hasher(const state& st) : st(const_cast<state&>(st)), funcs(this->st) {}
+
+	void add(uint64_t v) {
+		r = (r ^ v) * 0x100000001b3;
+	}
+
+	uint32_t result() const {
+		return (uint32_t)(r ^ r >> 32);
+	}
+
+	void log(const char* name) {
+		if (field_log) field_log->push_back({name, r});
+	}
+
+	template<typename T>
+	void field(const char* name, const T& v) {
+		(*this)(v);
+		log(name);
+	}
+
+	template<typename list_T>
+	void list(const char* name, const list_T& v) {
+		for (auto* n : ptr(v)) (*this)(n);
+		add(0);
+		log(name);
+	}
+
+	template<typename T, typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type* = nullptr>
+	void operator()(T v) {
+		add((uint64_t)v);
+	}
+	template<size_t integer_bits, size_t fractional_bits, bool is_signed, bool exact_integer_bits>
+	void operator()(fixed_point<integer_bits, fractional_bits, is_signed, exact_integer_bits> v) {
+		add((uint64_t)v.raw_value);
+	}
+	template<typename T>
+	void operator()(xy_t<T> v) {
+		(*this)(v.x);
+		(*this)(v.y);
+	}
+	void operator()(rect v) {
+		(*this)(v.from);
+		(*this)(v.to);
+	}
+	template<typename T>
+	void operator()(unit_id_t<T> v) {
+		add(v.raw_value);
+	}
+	template<typename T, size_t N>
+	void operator()(const std::array<T, N>& v) {
+		for (auto& x : v) (*this)(x);
+	}
+	template<typename T, typename index_T>
+	void operator()(const type_indexed_array<T, index_T>& v) {
+		for (auto& x : v) (*this)(x);
+	}
+	template<typename T, size_t N>
+	void operator()(const static_vector<T, N>& v) {
+		add(v.size());
+		for (auto& x : v) (*this)(x);
+	}
+	void operator()(const player_t& v) {
+		(*this)(v.controller);
+		(*this)(v.race);
+		(*this)(v.force);
+		(*this)(v.victory_state);
+	}
+	void operator()(const target_t& v) {
+		(*this)(v.pos);
+		(*this)(v.unit);
+	}
+	void operator()(const order_target_t& v) {
+		(*this)(v.position);
+		(*this)(v.unit);
+		(*this)(v.unit_type);
+	}
+
+	// Objects by index, types by id.
+	template<typename T>
+	auto operator()(const T* v) -> decltype((void)v->index) {
+		add(v ? (uint64_t)v->index + 1 : 0);
+	}
+	template<typename T>
+	auto operator()(const T* v) -> decltype((void)v->id) {
+		add(v ? (uint64_t)v->id + 1 : 0);
+	}
+	void operator()(const thingy_t* v) {
+		add(v ? 1 : 0);
+	}
+	void operator()(const path_t* v) {
+		add(v ? 1 : 0);
+	}
+
+	void flingy(const flingy_t* f) {
+		field("hp", f->hp);
+		field("sprite", f->sprite);
+		field("move_target", f->move_target);
+		field("next_movement_waypoint", f->next_movement_waypoint);
+		field("next_target_waypoint", f->next_target_waypoint);
+		field("movement_flags", f->movement_flags);
+		field("heading", f->heading);
+		field("flingy_turn_rate", f->flingy_turn_rate);
+		field("next_velocity_direction", f->next_velocity_direction);
+		field("flingy_type", f->flingy_type);
+		field("flingy_movement_type", f->flingy_movement_type);
+		field("position", f->position);
+		field("exact_position", f->exact_position);
+		field("flingy_top_speed", f->flingy_top_speed);
+		field("current_speed", f->current_speed);
+		field("next_speed", f->next_speed);
+		field("velocity", f->velocity);
+		field("flingy_acceleration", f->flingy_acceleration);
+		field("current_velocity_direction", f->current_velocity_direction);
+		field("desired_velocity_direction", f->desired_velocity_direction);
+		field("order_signal", f->order_signal);
+	}
+
+	void unit(const unit_t* u) {
+		field("index", u->index);
+		flingy(u);
+		field("owner", u->owner);
+		field("order_type", u->order_type);
+		field("order_state", u->order_state);
+		field("order_unit_type", u->order_unit_type);
+		field("main_order_timer", u->main_order_timer);
+		field("ground_weapon_cooldown", u->ground_weapon_cooldown);
+		field("air_weapon_cooldown", u->air_weapon_cooldown);
+		field("spell_cooldown", u->spell_cooldown);
+		field("order_target", u->order_target);
+		field("shield_points", u->shield_points);
+		field("unit_type", u->unit_type);
+		field("subunit", u->subunit);
+		field("auto_target_unit", u->auto_target_unit);
+		field("connected_unit", u->connected_unit);
+		field("order_queue_count", u->order_queue_count);
+		field("order_process_timer", u->order_process_timer);
+		field("unknown_0x086", u->unknown_0x086);
+		field("attack_notify_timer", u->attack_notify_timer);
+		field("previous_unit_type", u->previous_unit_type);
+		field("last_event_timer", u->last_event_timer);
+		field("last_event_color", u->last_event_color);
+		field("rank_increase", u->rank_increase);
+		field("kill_count", u->kill_count);
+		field("last_attacking_player", u->last_attacking_player);
+		field("secondary_order_timer", u->secondary_order_timer);
+		field("user_action_flags", u->user_action_flags);
+		field("cloak_counter", u->cloak_counter);
+		field("movement_state", u->movement_state);
+		field("build_queue", u->build_queue);
+		field("build_queue_limbo", u->build_queue_limbo);
+		field("energy", u->energy);
+		field("unit_id_generation", u->unit_id_generation);
+		field("secondary_order_type", u->secondary_order_type);
+		field("damage_overlay_state", u->damage_overlay_state);
+		field("hp_construction_rate", u->hp_construction_rate);
+		field("shield_construction_rate", u->shield_construction_rate);
+		field("remaining_build_time", u->remaining_build_time);
+		field("previous_hp", u->previous_hp);
+		field("loaded_units", u->loaded_units);
+		if (u->unit_type) {
+			if (funcs.unit_is(u, UnitTypes::Protoss_Interceptor) || funcs.unit_is(u, UnitTypes::Protoss_Scarab)) {
+				field("fighter.parent", u->fighter.parent);
+				field("fighter.is_outside", u->fighter.is_outside);
+			} else if (funcs.unit_is_carrier(u) || funcs.unit_is_reaver(u)) {
+				list("carrier.inside_units", u->carrier.inside_units);
+				list("carrier.outside_units", u->carrier.outside_units);
+				field("carrier.inside_count", u->carrier.inside_count);
+				field("carrier.outside_count", u->carrier.outside_count);
+			} else if (funcs.unit_is_vulture(u)) {
+				field("vulture.spider_mine_count", u->vulture.spider_mine_count);
+			} else if (funcs.unit_is_ghost(u)) {
+				field("ghost.nuke_dot", u->ghost.nuke_dot);
+			}
+		}
+		field("worker.powerup", u->worker.powerup);
+		field("worker.target_resource_position", u->worker.target_resource_position);
+		field("worker.target_resource_unit", u->worker.target_resource_unit);
+		field("worker.repair_timer", u->worker.repair_timer);
+		field("worker.is_gathering", u->worker.is_gathering);
+		field("worker.resources_carried", u->worker.resources_carried);
+		field("worker.gather_target", u->worker.gather_target);
+		field("building.addon", u->building.addon);
+		field("building.addon_build_type", u->building.addon_build_type);
+		field("building.upgrade_research_time", u->building.upgrade_research_time);
+		field("building.researching_type", u->building.researching_type);
+		field("building.upgrading_type", u->building.upgrading_type);
+		field("building.larva_timer", u->building.larva_timer);
+		field("building.is_landing", u->building.is_landing);
+		field("building.creep_timer", u->building.creep_timer);
+		field("building.upgrading_level", u->building.upgrading_level);
+		field("building.rally", u->building.rally);
+		if (u->unit_type) {
+			if (funcs.ut_resource(u)) {
+				field("building.resource.resource_count", u->building.resource.resource_count);
+				field("building.resource.resource_iscript", u->building.resource.resource_iscript);
+				field("building.resource.is_being_gathered", u->building.resource.is_being_gathered);
+				list("building.resource.gather_queue", u->building.resource.gather_queue);
+			} else if (funcs.unit_is_nydus(u)) {
+				field("building.nydus.exit", u->building.nydus.exit);
+			} else if (funcs.unit_is(u, UnitTypes::Terran_Nuclear_Silo)) {
+				field("building.silo.nuke", u->building.silo.nuke);
+				field("building.silo.ready", u->building.silo.ready);
+			} else if (funcs.unit_is(u, UnitTypes::Protoss_Pylon)) {
+				field("building.pylon.psi_field_sprite", u->building.pylon.psi_field_sprite);
+			} else if (funcs.ut_powerup(u)) {
+				field("building.powerup.origin", u->building.powerup.origin);
+			} else if (funcs.unit_is_hatchery(u)) {
+				field("building.hatchery.larva_spawn_side_values", u->building.hatchery.larva_spawn_side_values);
+			}
+		}
+		field("status_flags", u->status_flags);
+		field("carrying_flags", u->carrying_flags);
+		field("wireframe_randomizer", u->wireframe_randomizer);
+		field("secondary_order_state", u->secondary_order_state);
+		field("move_target_timer", u->move_target_timer);
+		field("detected_flags", u->detected_flags);
+		field("current_build_unit", u->current_build_unit);
+		field("path", u->path);
+		if (u->path) {
+			field("path->delay", u->path->delay);
+			field("path->creation_frame", u->path->creation_frame);
+			field("path->state_flags", u->path->state_flags);
+			field("path->source", u->path->source);
+			field("path->destination", u->path->destination);
+			field("path->next", u->path->next);
+			field("path->current_long_path_index", u->path->current_long_path_index);
+			field("path->current_short_path_index", u->path->current_short_path_index);
+			field("path->long_path.size", u->path->long_path.size());
+			for (auto& v : u->path->short_path) (*this)(v);
+			field("path->short_path", u->path->short_path.size());
+		}
+		field("pathing_collision_counter", u->pathing_collision_counter);
+		field("pathing_flags", u->pathing_flags);
+		field("unused_0x106", u->unused_0x106);
+		field("is_being_healed", u->is_being_healed);
+		field("terrain_no_collision_bounds", u->terrain_no_collision_bounds);
+		field("remove_timer", u->remove_timer);
+		field("defensive_matrix_hp", u->defensive_matrix_hp);
+		field("defensive_matrix_timer", u->defensive_matrix_timer);
+		field("stim_timer", u->stim_timer);
+		field("ensnare_timer", u->ensnare_timer);
+		field("lockdown_timer", u->lockdown_timer);
+		field("irradiate_timer", u->irradiate_timer);
+		field("stasis_timer", u->stasis_timer);
+		field("plague_timer", u->plague_timer);
+		field("storm_timer", u->storm_timer);
+		field("irradiated_by", u->irradiated_by);
+		field("irradiate_owner", u->irradiate_owner);
+		field("parasite_flags", u->parasite_flags);
+		field("cycle_counter", u->cycle_counter);
+		field("blinded_by", u->blinded_by);
+		field("maelstrom_timer", u->maelstrom_timer);
+		field("acid_spore_count", u->acid_spore_count);
+		field("acid_spore_time", u->acid_spore_time);
+		field("next_hit_near_target_position_index", u->next_hit_near_target_position_index);
+		field("air_strength", u->air_strength);
+		field("ground_strength", u->ground_strength);
+		field("repulse_flags", u->repulse_flags);
+		field("repulse_direction", u->repulse_direction);
+		field("repulse_index", u->repulse_index);
+		for (const order_t* o : ptr(u->order_queue)) {
+			field("order_queue.order_type", o->order_type);
+			field("order_queue.target", o->target);
+		}
+	}
+
+	void bullet(const bullet_t* b) {
+		field("index", b->index);
+		flingy(b);
+		field("bullet_state", b->bullet_state);
+		field("bullet_target", b->bullet_target);
+		field("bullet_target_pos", b->bullet_target_pos);
+		field("weapon_type", b->weapon_type);
+		field("remaining_time", b->remaining_time);
+		field("hit_flags", b->hit_flags);
+		field("remaining_bounces", b->remaining_bounces);
+		field("owner", b->owner);
+		field("bullet_owner_unit", b->bullet_owner_unit);
+		field("prev_bounce_unit", b->prev_bounce_unit);
+		field("hit_near_target_position_index", b->hit_near_target_position_index);
+	}
+
+	void image(const image_t* i) {
+		field("index", i->index);
+		field("image_type", i->image_type);
+		field("modifier", i->modifier);
+		field("frame_index_offset", i->frame_index_offset);
+		field("flags", i->flags);
+		field("offset", i->offset);
+		field("iscript_state.current_script", i->iscript_state.current_script ? i->iscript_state.current_script->id + 1 : 0);
+		field("iscript_state.program_counter", i->iscript_state.program_counter);
+		field("iscript_state.return_address", i->iscript_state.return_address);
+		field("iscript_state.animation", i->iscript_state.animation);
+		field("iscript_state.wait", i->iscript_state.wait);
+		field("frame_index_base", i->frame_index_base);
+		field("frame_index", i->frame_index);
+		field("modifier_data1", i->modifier_data1);
+		field("modifier_data2", i->modifier_data2);
+		field("frozen_y_value", i->frozen_y_value);
+	}
+
+	void sprite(const sprite_t* s) {
+		field("index", s->index);
+		field("sprite_type", s->sprite_type);
+		field("owner", s->owner);
+		field("visibility_flags", s->visibility_flags);
+		field("elevation_level", s->elevation_level);
+		field("flags", s->flags & ~sprite_t::flag_selected);
+		field("width", s->width);
+		field("height", s->height);
+		field("position", s->position);
+		field("main_image", s->main_image);
+		for (const image_t* i : ptr(s->images)) image(i);
+		log("images");
+	}
+
+
+	// The objects of each subsystem in a fixed order: units by the list they
+	// are in, bullets by active_bullets and sprites (with their images) by tile
+	// line.
+	template<typename F>
+	void for_each_unit(F&& f) {
+		for (auto* list : {&st.visible_units, &st.hidden_units, &st.map_revealer_units, &st.dead_units}) {
+			for (const unit_t* u : ptr(*list)) f(u);
+			f((const unit_t*)nullptr);
+		}
+	}
+	template<typename F>
+	void for_each_bullet(F&& f) {
+		for (const bullet_t* b : ptr(st.active_bullets)) f(b);
+	}
+	template<typename F>
+	void for_each_sprite(F&& f) {
+		for (auto& list : st.sprites_on_tile_line) {
+			for (const sprite_t* s : ptr(list)) f(s);
+			f((const sprite_t*)nullptr);
+		}
+	}
+
+	void units() {
+		for_each_unit([&](const unit_t* u) {
+			if (u) unit(u);
+			else add(0);
+		});
+	}
+	void bullets() {
+		for_each_bullet([&](const bullet_t* b) {
+			bullet(b);
+		});
+	}
+	void sprites() {
+		for_each_sprite([&](const sprite_t* s) {
+			if (s) sprite(s);
+			else add(0);
+		});
+	}
+	void random_counts() {
+		(*this)(st.lcg_rand_state);
+		(*this)(st.total_random_counts);
+		(*this)(st.random_counts);
+	}
+	void tiles() {
+		for (auto& v : st.tiles) {
+			add(v.visible | v.explored << 8 | v.flags << 16);
+		}
+	}
+	void other() {
+		for (const thingy_t* t : ptr(st.active_thingies)) {
+			(*this)(t->hp);
+			(*this)(t->sprite);
+		}
+		for (auto v : st.repulse_field) add(v);
+		(*this)(st.players);
+		(*this)(st.alliances);
+		(*this)(st.upgrade_levels);
+		(*this)(st.tech_researched);
+		(*this)(st.unit_counts);
+		(*this)(st.completed_unit_counts);
+		(*this)(st.unit_score);
+		(*this)(st.building_score);
+		(*this)(st.supply_used);
+		(*this)(st.supply_available);
+		(*this)(st.shared_vision);
+		for (auto v : st.current_minerals) (*this)(v);
+		for (auto v : st.current_gas) (*this)(v);
+		(*this)(st.trigger_timer);
+		(*this)(st.creep_life.recede_timer);
+		(*this)(st.creep_life.lists_size);
+		(*this)(st.units_sync_hash);
+	}
+};
+
+// Per subsystem hashes of a state at a frame. Deep digests are computed by
+// state_hasher, the others by get_quick_state_digest.
+struct state_digest {
+	enum subsystem_t {
+		subsystem_units,
+		subsystem_bullets,
+		subsystem_sprites,
+		subsystem_random_counts,
+		subsystem_tiles,
+		subsystem_other,
+		subsystem_count
+	};
+
+	static const char* subsystem_name(subsystem_t subsystem) {
+		static const std::array<const char*, subsystem_count> names = {
+			"units", "bullets", "sprites", "random_counts", "tiles", "other"
+		};
+		return names.at(subsystem);
+	}
+
+	int frame = 0;
+	bool deep = true;
+	std::array<uint32_t, subsystem_count> hashes{};
+
+	bool operator==(const state_digest& n) const {
+		return frame == n.frame && deep == n.deep && hashes == n.hashes;
+	}
+	bool operator!=(const state_digest& n) const {
+		return !(*this == n);
+	}
+
+	uint32_t combined() const {
+		uint32_t r = 2166136261u;
+		for (auto v : hashes) r = (r ^ v) * 16777619u;
+		return r;
+	}
+};
+
+static inline state_digest get_state_digest(const state& st) {
+	state_digest r;
+	r.frame = st.current_frame;
+	auto get = [&](state_digest::subsystem_t subsystem, void (state_hasher::*f)()) {
+		state_hasher h(st);
+		(h.*f)();
+		r.hashes[subsystem] = h.result();
+	};
+	get(state_digest::subsystem_units, &state_hasher::units);
+	get(state_digest::subsystem_bullets, &state_hasher::bullets);
+	get(state_digest::subsystem_sprites, &state_hasher::sprites);
+	get(state_digest::subsystem_random_counts, &state_hasher::random_counts);
+	get(state_digest::subsystem_tiles, &state_hasher::tiles);
+	get(state_digest::subsystem_other, &state_hasher::other);
+	return r;
+}
+
+static inline uint32_t deep_state_hash(const state& st) {
+	return get_state_digest(st).combined();
+}
+
+// A state_digest of only the values that are kept up to date as the state
+// changes (st.units_sync_hash, the random number state and counts and the
+// sizes of the active lists), so it is cheap enough to take every frame. The
+// tiles are not covered.
+static inline state_digest get_quick_state_digest(const state& st) {
+	state_digest r;
+	r.frame = st.current_frame;
+	r.deep = false;
+	auto get = [&](state_digest::subsystem_t subsystem, auto&& f) {
+		uint64_t h = 0xcbf29ce484222325;
+		f([&](uint64_t v) {
+			h = (h ^ v) * 0x100000001b3;
+		});
+		r.hashes[subsystem] = (uint32_t)(h ^ h >> 32);
+	};
+	get(state_digest::subsystem_units, [&](auto add) {
+		add(st.units_sync_hash);
+	});
+	get(state_digest::subsystem_bullets, [&](auto add) {
+		add(st.active_bullets_size);
+	});
+	get(state_digest::subsystem_sprites, [&](auto add) {
+		add(st.active_thingies_size);
+	});
+	get(state_digest::subsystem_random_counts, [&](auto add) {
+		add(st.lcg_rand_state);
+		add((uint32_t)st.total_random_counts);
+		for (auto v : st.random_counts) add((uint32_t)v);
+	});
+	get(state_digest::subsystem_other, [&](auto add) {
+		add(st.active_orders_size);
+		for (auto v : st.current_minerals) add((uint32_t)v);
+		for (auto v : st.current_gas) add((uint32_t)v);
+		for (auto v : st.supply_used) for (auto n : v) add((uint32_t)n.raw_value);
+		add((uint32_t)st.trigger_timer);
+	});
+	return r;
+}
+
+// The state_digests of the last capacity entries. record takes a quick digest
+// every frame, and also a deep one every deep_interval frames if deep_interval
+// is not 0, since a deep digest costs about as much as copying the state.
+//
+// The text format is one line per digest: the frame number, q or d for quick
+// or deep, and the subsystem hashes in hex, in the order of
+// state_digest::subsystem_t.
+struct state_digest_log {
+	size_t capacity;
+	int deep_interval = 0;
+	a_vector<state_digest> entries;
+	size_t next = 0;
+
+	explicit state_digest_log(size_t capacity = 24 * 60 * 5) : capacity(capacity) {}
+
+	void add(const state_digest& v) {
+		if (capacity == 0) return;
+		if (entries.size() < capacity) {
+			entries.push_back(v);
+		} else {
+			entries[next] = v;
+			next = (next + 1) % capacity;
+		}
+	}
+
+	void record(const state& st) {
+		add(get_quick_state_digest(st));
+		if (deep_interval && st.current_frame % deep_interval == 0) add(get_state_digest(st));
+	}
+
+	// Oldest first.
+	a_vector<state_digest> ordered() const {
+		a_vector<state_digest> r;
+		r.reserve(entries.size());
+		for (size_t i = 0; i != entries.size(); ++i) {
+			r.push_back(entries[(next + i) % entries.size()]);
+		}
+		return r;
+	}
+
+	a_string text() const {
+		a_string r;
+		for (auto& v : ordered()) {
+			r += format("%d %c", v.frame, v.deep ? 'd' : 'q');
+			for (auto h : v.hashes) r += format(" %08x", h);
+			r += "\n";
+		}
+		return r;
+	}
+
+	void save(a_string filename) const {
+		a_string data = text();
+		FILE* f = fopen(filename.c_str(), "wb");
+		if (!f) error("state_digest_log: failed to open %s for writing", filename.c_str());
+		bool ok = data.empty() || fwrite(data.data(), data.size(), 1, f) == 1;
+		if (fclose(f) || !ok) error("state_digest_log: %s: write error", filename.c_str());
+	}
+
+	static a_vector<state_digest> load(a_string filename) {
+		data_loading::file_reader<> r(filename);
+		a_vector<char> data = r.get_vec<char>(r.size());
+		data.push_back(0);
+		a_vector<state_digest> result;
+		const char* p = data.data();
+		while (*p) {
+			char* end;
+			state_digest v;
+			v.frame = (int)std::strtol(p, &end, 10);
+			if (end == p) error("state_digest_log: %s: bad line", filename.c_str());
+			p = end;
+			while (*p == ' ') ++p;
+			if (*p != 'q' && *p != 'd') error("state_digest_log: %s: bad line", filename.c_str());
+			v.deep = *p++ == 'd';
+			for (auto& h : v.hashes) {
+				h = (uint32_t)std::strtoul(p, &end, 16);
+				if (end == p) error("state_digest_log: %s: bad line", filename.c_str());
+				p = end;
+			}
+			while (*p == '\r' || *p == '\n' || *p == ' ') ++p;
+			result.push_back(v);
+		}
+		return result;
+	}
+};
+
+// Compares the objects visited in the same order by a_f and b_f, two
+// for_each_* functions of state_hasher, and calls f with the first pair of
+// objects that differ and the name of the first differing field. Either
+// object is null if the other state has more objects at that point. Returns
+// false if all objects are equal.
+template<typename T, typename for_each_F, typename F>
+bool diff_objects(const state& a, const state& b, for_each_F&& for_each, void (state_hasher::*hash)(const T*), F&& f) {
+	a_vector<const T*> objects_a;
+	a_vector<const T*> objects_b;
+	state_hasher ha(a);
+	state_hasher hb(b);
+	for_each(ha, [&](const T* v) {
+		objects_a.push_back(v);
+	});
+	for_each(hb, [&](const T* v) {
+		objects_b.push_back(v);
+	});
+	for (size_t i = 0; i != std::max(objects_a.size(), objects_b.size()); ++i) {
+		const T* va = i < objects_a.size() ? objects_a[i] : nullptr;
+		const T* vb = i < objects_b.size() ? objects_b[i] : nullptr;
+		if (!va && !vb) continue;
+		if (!va || !vb) {
+			f(va, vb, "");
+			return true;
+		}
+		a_vector<state_hasher::field_log_entry> log_a;
+		a_vector<state_hasher::field_log_entry> log_b;
+		state_hasher fa(a);
+		state_hasher fb(b);
+		fa.field_log = &log_a;
+		fb.field_log = &log_b;
+		(fa.*hash)(va);
+		(fb.*hash)(vb);
+		for (size_t n = 0; n != std::min(log_a.size(), log_b.size()); ++n) {
+			if (log_a[n].hash != log_b[n].hash) {
+				f(va, vb, log_a[n].name);
+				return true;
+			}
+		}
+		if (log_a.size() != log_b.size()) {
+			f(va, vb, "");
+			return true;
+		}
+	}
+	return false;
+}
+
+}
+
+#endif
@@ -0,0 +1,903 @@
+#ifndef BWGAME_STATE_SERIALIZATION_H
+#define BWGAME_STATE_SERIALIZATION_H
+
+#include "bwgame.h"
+#include "data_loading.h"
+
+#include <cstring>
+#include <type_traits>
+
+namespace bwgame {
+
+// Binary save format for a state.
+//
+// Objects in the object containers are written as their raw bytes, with every
+// pointer replaced by an index: units, bullets, sprites, images and orders by
+// their container index, paths and thingies by their position in st.paths and
+// st.thingies, and types by their position in the type tables. Intrusive list
+// links are not written; every list is written as the sequence of its members
+// instead and the loader rebuilds it.
+//
+// Objects on a container's free list may never have been initialized, so they
+// are written without their pointers and lists; they are set up again when the
+// object is reused.
+//
+// Since objects are written as raw bytes, a save can only be loaded by a build
+// with the same object layout. The header holds a layout fingerprint next to the
+// format version and load_state refuses saves where either differs.
+//
+// global_state and game_state are not part of the save. load_state expects
+// st.global and st.game to be set up for the same map as the saved state.
+struct state_serialization {
+	static constexpr uint32_t magic = 0x54535742; // BWST
+	static constexpr uint32_t version = 2;
+
+	static uint32_t layout_fingerprint() {
+		uint32_t r = 2166136261u;
+		auto add = [&](size_t v) {
+			r = (r ^ (uint32_t)v) * 16777619u;
+		};
+		add(sizeof(void*));
+		add(sizeof(size_t));
+		add(sizeof(unit_t));
+		add(sizeof(bullet_t));
+		add(sizeof(sprite_t));
+		add(sizeof(image_t));
+		add(sizeof(order_t));
+		add(sizeof(thingy_t));
+		add(sizeof(tile_t));
+		add(sizeof(player_t));
+#ifdef BWGAME_GRID_UNIT_FINDER
+		add(1);
+#else
+		add(0);
+#endif
+		return r;
+	}
+
+	state& st;
+	state_functions funcs;
+	explicit state_serialization(state& st) : st(st), funcs(st) {}
+
+	// Calls f for every pointer in u except unit_type and the build queues,
+	// which are static_vectors and are written separately. Which union members
+	// hold pointers depends on the unit type, which is taken from typed.
+	template<typename F>
+	void unit_pointers(unit_t& u, const unit_t* typed, F&& f) {
+		f(u.sprite);
+		f(u.move_target.unit);
+		f(u.flingy_type);
+		f(u.order_type);
+		f(u.order_unit_type);
+		f(u.order_target.unit);
+		f(u.subunit);
+		f(u.auto_target_unit);
+		f(u.connected_unit);
+		f(u.previous_unit_type);
+		f(u.secondary_order_type);
+		if (typed->unit_type) {
+			if (funcs.unit_is(typed, UnitTypes::Protoss_Interceptor) || funcs.unit_is(typed, UnitTypes::Protoss_Scarab)) {
+				f(u.fighter.parent);
+			} else if (funcs.unit_is_ghost(typed)) {
+				f(u.ghost.nuke_dot);
+			}
+		}
+		f(u.worker.powerup);
+		f(u.worker.target_resource_unit);
+		f(u.worker.gather_target);
+		f(u.building.addon);
+		f(u.building.addon_build_type);
+		f(u.building.researching_type);
+		f(u.building.upgrading_type);
+		f(u.building.rally.unit);
+		if (typed->unit_type) {
+			if (funcs.ut_resource(typed)) {
+			} else if (funcs.unit_is_nydus(typed)) {
+				f(u.building.nydus.exit);
+			} else if (funcs.unit_is(typed, UnitTypes::Terran_Nuclear_Silo)) {
+				f(u.building.silo.nuke);
+			} else if (funcs.unit_is(typed, UnitTypes::Protoss_Pylon)) {
+				f(u.building.pylon.psi_field_sprite);
+			}
+		}
+		f(u.current_build_unit);
+		f(u.path);
+		f(u.irradiated_by);
+	}
+
+	// Calls links for every intrusive list link in u and lists for every
+	// intrusive list that u holds.
+	template<typename links_F, typename lists_F>
+	void unit_links(unit_t& u, const unit_t* typed, links_F&& links, lists_F&& lists) {
+		links(u.link);
+		links(u.player_units_link);
+		links(u.cloaked_unit_link);
+		links(u.worker.gather_link);
+		lists(u.order_queue);
+		if (typed->unit_type) {
+			if (funcs.unit_is(typed, UnitTypes::Protoss_Interceptor) || funcs.unit_is(typed, UnitTypes::Protoss_Scarab)) {
+				links(u.fighter.fighter_link);
+			} else if (funcs.unit_is_carrier(typed)) {
+				lists(u.carrier.inside_units);
+				lists(u.carrier.outside_units);
+			} else if (funcs.unit_is_reaver(typed)) {
+				lists(u.reaver.inside_units);
+				lists(u.reaver.outside_units);
+			}
+			if (funcs.ut_resource(typed)) {
+				lists(u.building.resource.gather_queue);
+			} else if (funcs.unit_is(typed, UnitTypes::Protoss_Pylon)) {
+				links(u.building.pylon.psionic_matrix_link);
+			}
+		}
+	}
+
+	template<typename F>
+	static void bullet_pointers(bullet_t& b, F&& f) {
+		f(b.sprite);
+		f(b.move_target.unit);
+		f(b.flingy_type);
+		f(b.bullet_target);
+		f(b.weapon_type);
+		f(b.bullet_owner_unit);
+		f(b.prev_bounce_unit);
+	}
+
+	template<typename F>
+	static void sprite_pointers(sprite_t& s, F&& f) {
+		f(s.sprite_type);
+		f(s.main_image);
+	}
+
+	template<typename F>
+	static void image_pointers(image_t& i, F&& f) {
+		f(i.image_type);
+		f(i.iscript_state.current_script);
+		f(i.grp);
+		f(i.sprite);
+	}
+
+	template<typename F>
+	static void order_pointers(order_t& o, F&& f) {
+		f(o.order_type);
+		f(o.target.unit);
+		f(o.target.unit_type);
+	}
+
+	// The state level intrusive lists, in the order they are written.
+	template<typename st_T, typename F>
+	static void state_lists(st_T& st, F&& f) {
+		f(st.free_thingies);
+		f(st.active_thingies);
+		f(st.free_paths);
+		f(st.orders_container.free_list);
+		f(st.images_container.free_list);
+		f(st.sprites_container.free_list);
+		f(st.bullets_container.free_list);
+		f(st.active_bullets);
+		f(st.cloaked_units);
+		f(st.psionic_matrix_units);
+		for (auto& v : st.player_units) f(v);
+		f(st.units_container.free_list);
+		f(st.dead_units);
+		f(st.map_revealer_units);
+		f(st.hidden_units);
+		f(st.visible_units);
+	}
+
+	// Every field of state_base_copyable except global and game.
+	template<typename st_T, typename F>
+	static void copyable_fields(st_T& st, F&& f) {
+		f(st.update_tiles_countdown);
+		f(st.order_timer_counter);
+		f(st.secondary_order_timer_counter);
+		f(st.current_frame);
+		f(st.players);
+		f(st.alliances);
+		f(st.upgrade_levels);
+		f(st.upgrade_upgrading);
+		f(st.tech_researched);
+		f(st.tech_researching);
+		f(st.unit_counts);
+		f(st.completed_unit_counts);
+		f(st.factory_counts);
+		f(st.building_counts);
+		f(st.non_building_counts);
+		f(st.completed_factory_counts);
+		f(st.completed_building_counts);
+		f(st.completed_non_building_counts);
+		f(st.total_buildings_ever_completed);
+		f(st.total_non_buildings_ever_completed);
+		f(st.unit_score);
+		f(st.building_score);
+		f(st.supply_used);
+		f(st.supply_available);
+		f(st.shared_vision);
+		f(st.tiles);
+		f(st.tiles_mega_tile_index);
+		f(st.random_counts);
+		f(st.total_random_counts);
+		f(st.lcg_rand_state);
+		f(st.last_error);
+		f(st.units_sync_hash);
+		f(st.trigger_timer);
+		f(st.running_triggers);
+		f(st.trigger_wait_timers);
+		f(st.trigger_waiting);
+		f(st.active_orders_size);
+		f(st.active_bullets_size);
+		f(st.active_thingies_size);
+		f(st.repulse_field);
+		f(st.prev_bullet_heading_offset_clockwise);
+		f(st.current_minerals);
+		f(st.current_gas);
+		f(st.total_minerals_gathered);
+		f(st.total_gas_gathered);
+		f(st.recent_lurker_hits);
+		f(st.recent_lurker_hit_current_index);
+		f(st.creep_life);
+		f(st.update_psionic_matrix);
+		f(st.disruption_webbed_units);
+		f(st.cheats_enabled);
+		f(st.cheat_operation_cwal);
+		f(st.locations);
+	}
+
+	template<typename T, typename vec_T>
+	static size_t type_index(const T* v, const vec_T& vec) {
+		if (!v) return 0;
+		size_t index = v - vec.data();
+		if (index >= vec.size()) error("state_serialization: type pointer out of range");
+		return index + 1;
+	}
+	template<typename T, typename vec_T>
+	static const T* type_at(size_t index, const vec_T& vec) {
+		if (!index) return nullptr;
+		if (index > vec.size()) error("state_serialization: type index %d out of range", index);
+		return &vec[index - 1];
+	}
+
+	template<typename T, size_t max_size, size_t allocation_granularity>
+	static T* slot(object_container<T, max_size, allocation_granularity>& c, size_t position) {
+		return &c.list[position / allocation_granularity][position % allocation_granularity];
+	}
+
+	template<typename T, size_t max_size, size_t allocation_granularity>
+	static a_vector<bool> free_slots(object_container<T, max_size, allocation_granularity>& c) {
+		a_vector<bool> r(c.size);
+		for (auto* v : ptr(c.free_list)) {
+			r[v->index ? max_size - v->index : 0] = true;
+		}
+		return r;
+	}
+};
+
+struct state_writer: state_serialization {
+	a_vector<uint8_t>& data;
+	a_unordered_map<const path_t*, size_t> path_indices;
+	a_unordered_map<const thingy_t*, size_t> thingy_indices;
+
+	state_writer(const state& st, a_vector<uint8_t>& data) : state_serialization(const_cast<state&>(st)), data(data) {}
+
+	void put_bytes(const void* src, size_t n) {
+		auto* p = (const uint8_t*)src;
+		data.insert(data.end(), p, p + n);
+	}
+	void put_u32(size_t v) {
+		uint32_t n = (uint32_t)v;
+		put_bytes(&n, sizeof(n));
+	}
+
+	size_t code(const unit_t* v) const {
+		return v ? v->index + 1 : 0;
+	}
+	size_t code(const bullet_t* v) const {
+		return v ? v->index + 1 : 0;
+	}
+	size_t code(const sprite_t* v) const {
+		return v ? v->index + 1 : 0;
+	}
+	size_t code(const image_t* v) const {
+		return v ? v->index + 1 : 0;
+	}
+	size_t code(const order_t* v) const {
+		return v ? v->index + 1 : 0;
+	}
+	size_t code(const path_t* v) const {
+		if (!v) return 0;
+		auto i = path_indices.find(v);
+		if (i == path_indices.end()) error("state_writer: path not found");
+		return i->second + 1;
+	}
+	size_t code(const thingy_t* v) const {
+		if (!v) return 0;
+		auto i = thingy_indices.find(v);
+		if (i == thingy_indices.end()) error("state_writer: thingy not found");
+		return i->second + 1;
+	}
+	size_t code(const unit_type_t* v) const {
+		return type_index(v, st.game->unit_types.vec);
+	}
+	size_t code(const weapon_type_t* v) const {
+		return type_index(v, st.game->weapon_types.vec);
+	}
+	size_t code(const upgrade_type_t* v) const {
+		return type_index(v, st.game->upgrade_types.vec);
+	}
+	size_t code(const tech_type_t* v) const {
+		return type_index(v, st.game->tech_types.vec);
+	}
+	size_t code(const flingy_type_t* v) const {
+		return type_index(v, st.global->flingy_types.vec);
+	}
+	size_t code(const sprite_type_t* v) const {
+		return type_index(v, st.global->sprite_types.vec);
+	}
+	size_t code(const image_type_t* v) const {
+		return type_index(v, st.global->image_types.vec);
+	}
+	size_t code(const order_type_t* v) const {
+		return type_index(v, st.global->order_types.vec);
+	}
+	size_t code(const grp_t* v) const {
+		return type_index(v, st.global->grps);
+	}
+	size_t code(const iscript_t::script* v) const {
+		return v ? (size_t)v->id + 1 : 0;
+	}
+	size_t code(const regions_t::region* v) const {
+		return type_index(v, st.game->regions.regions);
+	}
+	size_t code(const trigger* v) const {
+		return type_index(v, st.game->triggers);
+	}
+
+	template<typename T>
+	void encode(T*& v) const {
+		v = (T*)(uintptr_t)code(v);
+	}
+
+	template<typename T, typename std::enable_if<std::is_trivially_copyable<T>::value>::type* = nullptr>
+	void value(const T& v) {
+		put_bytes(&v, sizeof(v));
+	}
+	template<typename T, size_t N, typename std::enable_if<!std::is_trivially_copyable<T>::value>::type* = nullptr>
+	void value(const std::array<T, N>& v) {
+		for (auto& x : v) value(x);
+	}
+	template<typename T>
+	void value(const a_vector<T>& v) {
+		put_u32(v.size());
+		if (std::is_trivially_copyable<T>::value) put_bytes(v.data(), sizeof(T) * v.size());
+		else for (auto& x : v) value(x);
+	}
+	template<typename A, typename B>
+	void value(const std::pair<A, B>& v) {
+		value(v.first);
+		value(v.second);
+	}
+	template<typename T, size_t N>
+	void value(const static_vector<T, N>& v) {
+		put_u32(v.size());
+		for (auto& x : v) value(x);
+	}
+	void value(const running_trigger& v) {
+		value(v.actions);
+		put_u32(code(v.t));
+		value(v.flags);
+		value(v.current_action_index);
+	}
+	void value(const creep_life_t& v) {
+		value(v.recede_timer);
+		value(v.check_dead_unit_timer);
+		put_u32(v.entry_container.size());
+		for (auto& e : v.entry_container) {
+			value(e.tile_pos);
+			value(e.n_neighboring_creep_tiles);
+		}
+		auto list = [&](auto& l) {
+			size_t n = 0;
+			for (auto& e : l) {
+				(void)e;
+				++n;
+			}
+			put_u32(n);
+			for (auto& e : l) put_u32(&e - v.entry_container.data());
+		};
+		for (auto& l : v.lists) list(l);
+		value(v.lists_size);
+		list(v.free_list);
+		value(v.free_list_size);
+		for (auto& l : v.table.buckets) list(l);
+	}
+
+	template<typename list_T>
+	void list(const list_T& l) {
+		size_t n = 0;
+		for (auto* v : ptr(l)) {
+			(void)v;
+			++n;
+		}
+		put_u32(n);
+		for (auto* v : ptr(l)) put_u32(code(v));
+	}
+
+	template<typename T, size_t max_size, size_t allocation_granularity, typename F>
+	void objects(object_container<T, max_size, allocation_granularity>& c, const a_vector<bool>& free, F&& f) {
+		put_u32(c.size);
+		for (size_t i = 0; i != c.size; ++i) {
+			T* v = slot(c, i);
+			alignas(T) uint8_t buf[sizeof(T)];
+			memcpy(buf, (void*)v, sizeof(T));
+			f(*(T*)buf, v, free[i]);
+			put_bytes(buf, sizeof(T));
+		}
+	}
+
+	void path(path_t& v) {
+		value(v.delay);
+		value(v.creation_frame);
+		value(v.state_flags);
+		put_u32(v.long_path.size());
+		for (auto* r : v.long_path) put_u32(code(r));
+		value(v.full_long_path_size);
+		put_u32(v.short_path.size());
+		for (auto& p : v.short_path) value(p);
+		value(v.current_long_path_index);
+		value(v.current_short_path_index);
+		value(v.source);
+		value(v.destination);
+		value(v.next);
+		value(v.last_collision_unit);
+		value(v.last_collision_speed);
+		value(v.slide_free_direction);
+	}
+
+	void operator()() {
+		for (auto& v : st.paths) path_indices[&v] = path_indices.size();
+		for (auto& v : st.thingies) thingy_indices[&v] = thingy_indices.size();
+
+		put_u32(magic);
+		put_u32(version);
+		put_u32(layout_fingerprint());
+		put_u32(st.game->map_tile_width);
+		put_u32(st.game->map_tile_height);
+
+		copyable_fields(st, [&](auto& v) {
+			value(v);
+		});
+
+		auto clear = [&](auto& v) {
+			v = {};
+		};
+		auto clear_list = [&](auto& v) {
+			memset((void*)&v, 0, sizeof(v));
+		};
+		auto pointers = [&](bool free) {
+			return [&, free](auto& v) {
+				if (free) v = {};
+				else encode(v);
+			};
+		};
+		a_vector<bool> free_units = free_slots(st.units_container);
+		a_vector<bool> free_sprites = free_slots(st.sprites_container);
+		objects(st.units_container, free_units, [&](unit_t& u, const unit_t* typed, bool free) {
+			if (free) {
+				u.unit_type = nullptr;
+				typed = &u;
+			}
+			unit_pointers(u, typed, pointers(free));
+			encode(u.unit_type);
+			unit_links(u, typed, clear, clear_list);
+			clear_list(u.build_queue);
+			clear_list(u.build_queue_limbo);
+		});
+		objects(st.bullets_container, free_slots(st.bullets_container), [&](bullet_t& b, const bullet_t*, bool free) {
+			bullet_pointers(b, pointers(free));
+			b.link = {};
+		});
+		objects(st.sprites_container, free_sprites, [&](sprite_t& s, const sprite_t*, bool free) {
+			sprite_pointers(s, pointers(free));
+			s.link = {};
+			clear_list(s.images);
+		});
+		objects(st.images_container, free_slots(st.images_container), [&](image_t& i, const image_t*, bool free) {
+			image_pointers(i, pointers(free));
+			i.link = {};
+		});
+		objects(st.orders_container, free_slots(st.orders_container), [&](order_t& o, const order_t*, bool free) {
+			order_pointers(o, pointers(free));
+			o.link = {};
+		});
+
+		put_u32(st.paths.size());
+		for (auto& v : st.paths) path(v);
+		put_u32(st.thingies.size());
+		for (auto& v : st.thingies) {
+			value(v.hp);
+			put_u32(code(v.sprite));
+		}
+
+		state_lists(st, [&](auto& l) {
+			list(l);
+		});
+		put_u32(st.sprites_on_tile_line.size());
+		for (auto& l : st.sprites_on_tile_line) list(l);
+		for (size_t i = 0; i != st.units_container.size; ++i) {
+			unit_t* u = slot(st.units_container, i);
+			if (free_units[i]) {
+				put_u32(0);
+				put_u32(0);
+				put_u32(0);
+				continue;
+			}
+			for (auto* q : {&u->build_queue, &u->build_queue_limbo}) {
+				put_u32(q->size());
+				for (auto* v : *q) put_u32(code(v));
+			}
+			unit_links(*u, u, [&](auto&) {}, [&](auto& l) {
+				list(l);
+			});
+		}
+		for (size_t i = 0; i != st.sprites_container.size; ++i) {
+			if (free_sprites[i]) put_u32(0);
+			else list(slot(st.sprites_container, i)->images);
+		}
+
+#ifdef BWGAME_GRID_UNIT_FINDER
+		value(st.unit_finder_grid.width);
+		value(st.unit_finder_grid.height);
+		value(st.unit_finder_grid.front_order);
+		value(st.unit_finder_grid.back_order);
+		put_u32(st.unit_finder_grid.cells.size());
+		for (auto& c : st.unit_finder_grid.cells) {
+			put_u32(c.size());
+			for (auto* u : c) put_u32(code(u));
+		}
+#else
+		for (auto* vec : {&st.unit_finder_x, &st.unit_finder_y}) {
+			put_u32(vec->size());
+			for (auto& v : *vec) {
+				put_u32(code(v.u));
+				value(v.value);
+			}
+		}
+#endif
+		put_u32(code(st.consider_collision_with_unit_bug));
+		put_u32(code(st.prev_bullet_source_unit));
+	}
+};
+
+struct state_reader: state_serialization {
+	data_loading::data_reader_le r;
+	a_vector<path_t*> paths;
+	a_vector<thingy_t*> thingies;
+
+	state_reader(state& st, const uint8_t* data, size_t data_size) : state_serialization(st), r(data, data + data_size) {}
+
+	size_t get_u32() {
+		return r.get<uint32_t>();
+	}
+
+	void decode(unit_t*& v) {
+		size_t n = (uintptr_t)v;
+		v = n ? st.units_container.at(n - 1) : nullptr;
+	}
+	void decode(bullet_t*& v) {
+		size_t n = (uintptr_t)v;
+		v = n ? st.bullets_container.at(n - 1) : nullptr;
+	}
+	void decode(sprite_t*& v) {
+		size_t n = (uintptr_t)v;
+		v = n ? st.sprites_container.at(n - 1) : nullptr;
+	}
+	void decode(image_t*& v) {
+		size_t n = (uintptr_t)v;
+		v = n ? st.images_container.at(n - 1) : nullptr;
+	}
+	void decode(order_t*& v) {
+		size_t n = (uintptr_t)v;
+		v = n ? st.orders_container.at(n - 1) : nullptr;
+	}
+	void decode(path_t*& v) {
+		size_t n = (uintptr_t)v;
+		if (n > paths.size()) error("state_reader: path index %d out of range", n);
+		v = n ? paths[n - 1] : nullptr;
+	}
+	void decode(thingy_t*& v) {
+		size_t n = (uintptr_t)v;
+		if (n > thingies.size()) error("state_reader: thingy index %d out of range", n);
+		v = n ? thingies[n - 1] : nullptr;
+	}
+	void decode(const unit_type_t*& v) {
+		v = type_at<unit_type_t>((uintptr_t)v, st.game->unit_types.vec);
+	}
+	void decode(const weapon_type_t*& v) {
+		v = type_at<weapon_type_t>((uintptr_t)v, st.game->weapon_types.vec);
+	}
+	void decode(const upgrade_type_t*& v) {
+		v = type_at<upgrade_type_t>((uintptr_t)v, st.game->upgrade_types.vec);
+	}
+	void decode(const tech_type_t*& v) {
+		v = type_at<tech_type_t>((uintptr_t)v, st.game->tech_types.vec);
+	}
+	void decode(const flingy_type_t*& v) {
+		v = type_at<flingy_type_t>((uintptr_t)v, st.global->flingy_types.vec);
+	}
+	void decode(const sprite_type_t*& v) {
+		v = type_at<sprite_type_t>((uintptr_t)v, st.global->sprite_types.vec);
+	}
+	void decode(const image_type_t*& v) {
+		v = type_at<image_type_t>((uintptr_t)v, st.global->image_types.vec);
+	}
+	void decode(const order_type_t*& v) {
+		v = type_at<order_type_t>((uintptr_t)v, st.global->order_types.vec);
+	}
+	void decode(const grp_t*& v) {
+		v = type_at<grp_t>((uintptr_t)v, st.global->grps);
+	}
+	void decode(const iscript_t::script*& v) {
+		size_t n = (uintptr_t)v;
+		if (!n) {
+			v = nullptr;
+			return;
+		}
+		auto i = st.global->iscript.scripts.find((int)(n - 1));
+		if (i == st.global->iscript.scripts.end()) error("state_reader: iscript %d not found", n - 1);
+		v = &i->second;
+	}
+	void decode(const regions_t::region*& v) {
+		v = type_at<regions_t::region>((uintptr_t)v, st.game->regions.regions);
+	}
+	void decode(const trigger*& v) {
+		v = type_at<trigger>((uintptr_t)v, st.game->triggers);
+	}
+	template<typename T>
+	T* get_code() {
+		T* r = (T*)(uintptr_t)get_u32();
+		decode(r);
+		return r;
+	}
+
+	template<typename T, typename std::enable_if<std::is_trivially_copyable<T>::value>::type* = nullptr>
+	void value(T& v) {
+		r.get_bytes((uint8_t*)&v, sizeof(v));
+	}
+	template<typename T, size_t N, typename std::enable_if<!std::is_trivially_copyable<T>::value>::type* = nullptr>
+	void value(std::array<T, N>& v) {
+		for (auto& x : v) value(x);
+	}
+	template<typename T>
+	void value(a_vector<T>& v) {
+		v.resize(get_u32());
+		if (std::is_trivially_copyable<T>::value) r.get_bytes((uint8_t*)v.data(), sizeof(T) * v.size());
+		else for (auto& x : v) value(x);
+	}
+	template<typename A, typename B>
+	void value(std::pair<A, B>& v) {
+		value(v.first);
+		value(v.second);
+	}
+	template<typename T, size_t N>
+	void value(static_vector<T, N>& v) {
+		size_t n = get_u32();
+		if (n > N) error("state_reader: static_vector size %d out of range", n);
+		v.resize(n);
+		for (auto& x : v) value(x);
+	}
+	void value(running_trigger& v) {
+		value(v.actions);
+		v.t = get_code<const trigger>();
+		value(v.flags);
+		value(v.current_action_index);
+	}
+	void value(creep_life_t& v) {
+		value(v.recede_timer);
+		value(v.check_dead_unit_timer);
+		size_t n = get_u32();
+		if (n != v.entry_container.size()) error("state_reader: creep entry count mismatch (%d, expected %d)", n, v.entry_container.size());
+		for (auto& e : v.entry_container) {
+			value(e.tile_pos);
+			value(e.n_neighboring_creep_tiles);
+		}
+		auto list = [&](auto& l) {
+			l.clear();
+			size_t n = get_u32();
+			for (size_t i = 0; i != n; ++i) {
+				size_t index = get_u32();
+				if (index >= v.entry_container.size()) error("state_reader: creep entry index %d out of range", index);
+				l.push_back(v.entry_container[index]);
+			}
+		};
+		for (auto& l : v.lists) list(l);
+		value(v.lists_size);
+		list(v.free_list);
+		value(v.free_list_size);
+		for (auto& l : v.table.buckets) list(l);
+	}
+
+	template<typename list_T>
+	void list(list_T& l) {
+		size_t n = get_u32();
+		for (size_t i = 0; i != n; ++i) {
+			auto* v = get_code<typename list_T::value_type>();
+			if (!v) error("state_reader: null list entry");
+			l.push_back(*v);
+		}
+	}
+
+	template<typename T, size_t max_size, size_t allocation_granularity>
+	void objects(object_container<T, max_size, allocation_granularity>& c) {
+		size_t n = get_u32();
+		if (n > max_size) error("state_reader: object count %d out of range", n);
+		while (c.size < n) c.grow(false);
+		for (size_t i = 0; i != n; ++i) {
+			r.get_bytes((uint8_t*)slot(c, i), sizeof(T));
+		}
+	}
+
+	void path(path_t& v) {
+		value(v.delay);
+		value(v.creation_frame);
+		value(v.state_flags);
+		v.long_path.clear();
+		for (size_t n = get_u32(); n; --n) v.long_path.push_back(get_code<const regions_t::region>());
+		value(v.full_long_path_size);
+		v.short_path.clear();
+		for (size_t n = get_u32(); n; --n) {
+			xy p;
+			value(p);
+			v.short_path.push_back(p);
+		}
+		value(v.current_long_path_index);
+		value(v.current_short_path_index);
+		value(v.source);
+		value(v.destination);
+		value(v.next);
+		value(v.last_collision_unit);
+		value(v.last_collision_speed);
+		value(v.slide_free_direction);
+	}
+
+	void operator()() {
+		if (get_u32() != magic) error("load_state: invalid identifier");
+		size_t file_version = get_u32();
+		if (file_version != version) error("load_state: unsupported version %d (expected %d)", file_version, version);
+		if (get_u32() != layout_fingerprint()) error("load_state: saved by a build with a different object layout");
+		size_t map_tile_width = get_u32();
+		size_t map_tile_height = get_u32();
+		if (map_tile_width != st.game->map_tile_width || map_tile_height != st.game->map_tile_height) {
+			error("load_state: map size mismatch (%dx%d, expected %dx%d)", map_tile_width, map_tile_height, st.game->map_tile_width, st.game->map_tile_height);
+		}
+
+		copyable_fields(st, [&](auto& v) {
+			value(v);
+		});
+
+		(state_base_non_copyable&)st = state_base_non_copyable();
+
+		objects(st.units_container);
+		objects(st.bullets_container);
+		objects(st.sprites_container);
+		objects(st.images_container);
+		objects(st.orders_container);
+
+		for (size_t n = get_u32(); n; --n) {
+			st.paths.emplace_back();
+			paths.push_back(&st.paths.back());
+			path(st.paths.back());
+		}
+		for (size_t n = get_u32(); n; --n) {
+			st.thingies.emplace_back();
+			thingy_t* v = &st.thingies.back();
+			thingies.push_back(v);
+			value(v->hp);
+			v->link = {};
+			v->sprite = (sprite_t*)(uintptr_t)get_u32();
+		}
+
+		auto decoder = [&](auto& v) {
+			decode(v);
+		};
+		auto reset_list = [&](auto& v) {
+			new (&v) std::remove_reference_t<decltype(v)>();
+		};
+		for (size_t i = 0; i != st.units_container.size; ++i) {
+			unit_t* u = slot(st.units_container, i);
+			decode(u->unit_type);
+			unit_pointers(*u, u, decoder);
+			unit_links(*u, u, [&](auto&) {}, reset_list);
+			reset_list(u->build_queue);
+			reset_list(u->build_queue_limbo);
+		}
+		for (size_t i = 0; i != st.bullets_container.size; ++i) {
+			bullet_pointers(*slot(st.bullets_container, i), decoder);
+		}
+		for (size_t i = 0; i != st.sprites_container.size; ++i) {
+			sprite_t* s = slot(st.sprites_container, i);
+			sprite_pointers(*s, decoder);
+			reset_list(s->images);
+		}
+		for (size_t i = 0; i != st.images_container.size; ++i) {
+			image_pointers(*slot(st.images_container, i), decoder);
+		}
+		for (size_t i = 0; i != st.orders_container.size; ++i) {
+			order_pointers(*slot(st.orders_container, i), decoder);
+		}
+		for (auto* v : thingies) decode(v->sprite);
+
+		state_lists(st, [&](auto& l) {
+			list(l);
+		});
+		st.sprites_on_tile_line.resize(get_u32());
+		for (auto& l : st.sprites_on_tile_line) list(l);
+		for (size_t i = 0; i != st.units_container.size; ++i) {
+			unit_t* u = slot(st.units_container, i);
+			for (auto* q : {&u->build_queue, &u->build_queue_limbo}) {
+				size_t n = get_u32();
+				if (n > q->max_size()) error("state_reader: build queue size %d out of range", n);
+				for (; n; --n) q->push_back(get_code<const unit_type_t>());
+			}
+			unit_links(*u, u, [&](auto&) {}, [&](auto& l) {
+				list(l);
+			});
+		}
+		for (size_t i = 0; i != st.sprites_container.size; ++i) {
+			list(slot(st.sprites_container, i)->images);
+		}
+
+#ifdef BWGAME_GRID_UNIT_FINDER
+		value(st.unit_finder_grid.width);
+		value(st.unit_finder_grid.height);
+		value(st.unit_finder_grid.front_order);
+		value(st.unit_finder_grid.back_order);
+		st.unit_finder_grid.cells.resize(get_u32());
+		for (auto& c : st.unit_finder_grid.cells) {
+			c.resize(get_u32());
+			for (auto& u : c) u = get_code<unit_t>();
+		}
+#else
+		for (auto* vec : {&st.unit_finder_x, &st.unit_finder_y}) {
+			vec->resize(get_u32());
+			for (auto& v : *vec) {
+				v.u = get_code<unit_t>();
+				value(v.value);
+			}
+		}
+#endif
+		st.consider_collision_with_unit_bug = get_code<unit_t>();
+		st.prev_bullet_source_unit = get_code<unit_t>();
+		rebuild_unit_finder_bounding_boxes(st);
+
+		if (r.left()) error("load_state: %d trailing bytes", r.left());
+	}
+};
+
+static inline a_vector<uint8_t> save_state(const state& st) {
+	a_vector<uint8_t> r;
+	r.reserve(0x10000 + st.tiles.size() * (sizeof(tile_t) + sizeof(uint16_t)) + st.repulse_field.size() + st.units_container.size * sizeof(unit_t) + st.bullets_container.size * sizeof(bullet_t) + st.sprites_container.size * sizeof(sprite_t) + st.images_container.size * sizeof(image_t) + st.orders_container.size * sizeof(order_t) + st.paths.size() * 0x100);
+	state_writer(st, r)();
+	return r;
+}
+
+static inline void load_state(state& st, const uint8_t* data, size_t data_size) {
+	state_reader(st, data, data_size)();
+}
+
+static inline void save_state_file(const state& st, a_string filename) {
+	a_vector<uint8_t> data = save_state(st);
+	FILE* f = fopen(filename.c_str(), "wb");
+	if (!f) error("save_state_file: failed to open %s for writing", filename.c_str());
+	bool ok = fwrite(data.data(), data.size(), 1, f) == 1;
+	if (fclose(f) || !ok) error("save_state_file: %s: write error", filename.c_str());
+}
+
+static inline void load_state_file(state& st, a_string filename) {
+	data_loading::file_reader<> r(std::move(filename));
+	a_vector<uint8_t> data = r.get_vec<uint8_t>(r.size());
+	load_state(st, data.data(), data.size());
+}
+
+}
+
+#endif
@@ -0,0 +1,302 @@
+#ifndef BWGAME_STATE_SNAPSHOTS_H
+#define BWGAME_STATE_SNAPSHOTS_H
+
+#include "bwgame.h"
+
+#include <cstring>
+#include <memory>
+
+namespace bwgame {
+
+// A snapshot taken by state_snapshots. A full snapshot (base is null) holds every
+// object slot and tile. A delta snapshot only holds the object slots and tile
+// blocks whose bytes differ from its base, which is always a full snapshot.
+struct state_snapshot {
+	struct slots_t {
+		size_t size = 0;
+		a_vector<uint16_t> positions;
+		a_vector<uint8_t> data;
+	};
+	struct bytes_t {
+		size_t size = 0;
+		a_vector<uint32_t> blocks;
+		a_vector<uint8_t> data;
+	};
+
+	std::shared_ptr<const state_snapshot> base;
+	int frame = 0;
+
+	// tiles, tiles_mega_tile_index and repulse_field are empty here, they are
+	// stored in the bytes_t below.
+	state_base_copyable copyable;
+	bytes_t tiles;
+	bytes_t tiles_mega_tile_index;
+	bytes_t repulse_field;
+
+	slots_t units;
+	slots_t bullets;
+	slots_t sprites;
+	slots_t images;
+	slots_t orders;
+
+	a_vector<path_t> paths;
+	a_vector<thingy_t> thingies;
+	a_vector<uint8_t> lists;
+	size_t sprites_on_tile_line_size = 0;
+
+#ifdef BWGAME_GRID_UNIT_FINDER
+	state::unit_finder_grid_t unit_finder_grid;
+#else
+	a_vector<state::unit_finder_entry> unit_finder_x;
+	a_vector<state::unit_finder_entry> unit_finder_y;
+#endif
+	const unit_t* consider_collision_with_unit_bug = nullptr;
+	const unit_t* prev_bullet_source_unit = nullptr;
+
+	size_t memory_usage = 0;
+};
+
+// Takes and materializes state_snapshot.
+//
+// Every state is first copied with state_copier into the staging state, which
+// lives as long as this object and is only ever copied into, so objects and
+// the pointers between them always end up at the same addresses. That makes
+// the bytes of an object slot comparable between snapshots; a delta keeps the
+// slots that differ from the base and materialize writes the base and the
+// delta back into the staging state and returns a copy_state of it.
+//
+// Snapshots are only valid with the state_snapshots that took them, and all
+// states passed to take must be of the same map.
+struct state_snapshots {
+	static constexpr size_t block_size = 256;
+
+	state staging;
+
+	void clear() {
+		staging = state();
+	}
+
+	std::shared_ptr<const state_snapshot> take(const state& st, std::shared_ptr<const state_snapshot> base = nullptr) {
+		if (!staging.sprites_on_tile_line.empty() && staging.sprites_on_tile_line.size() != st.sprites_on_tile_line.size()) {
+			error("state_snapshots: map size changed");
+		}
+		if (base && base->base) base = base->base;
+
+		state_copier copier(st, staging);
+		copier();
+
+		auto r = std::make_shared<state_snapshot>();
+		const state_snapshot* b = base.get();
+		r->base = std::move(base);
+		r->frame = st.current_frame;
+
+		r->copyable = st;
+		save_vector(r->tiles, r->copyable.tiles, b ? &b->tiles : nullptr);
+		save_vector(r->tiles_mega_tile_index, r->copyable.tiles_mega_tile_index, b ? &b->tiles_mega_tile_index : nullptr);
+		save_vector(r->repulse_field, r->copyable.repulse_field, b ? &b->repulse_field : nullptr);
+
+		save_slots(r->units, staging.units_container, st.units_container.size, b ? &b->units : nullptr);
+		save_slots(r->bullets, staging.bullets_container, st.bullets_container.size, b ? &b->bullets : nullptr);
+		save_slots(r->sprites, staging.sprites_container, st.sprites_container.size, b ? &b->sprites : nullptr);
+		save_slots(r->images, staging.images_container, st.images_container.size, b ? &b->images : nullptr);
+		save_slots(r->orders, staging.orders_container, st.orders_container.size, b ? &b->orders : nullptr);
+
+		save_nodes(r->paths, staging.paths, copier.path_remap.size());
+		save_nodes(r->thingies, staging.thingies, copier.thingy_remap.size());
+		for_each_list(staging, [&](auto& v) {
+			auto* p = (const uint8_t*)&v;
+			r->lists.insert(r->lists.end(), p, p + sizeof(v));
+		});
+		r->sprites_on_tile_line_size = staging.sprites_on_tile_line.size();
+
+#ifdef BWGAME_GRID_UNIT_FINDER
+		r->unit_finder_grid = staging.unit_finder_grid;
+#else
+		r->unit_finder_x = staging.unit_finder_x;
+		r->unit_finder_y = staging.unit_finder_y;
+#endif
+		r->consider_collision_with_unit_bug = staging.consider_collision_with_unit_bug;
+		r->prev_bullet_source_unit = staging.prev_bullet_source_unit;
+
+		r->memory_usage = memory_usage(*r);
+		return r;
+	}
+
+	// Leaves the snapshot in the staging state as well, which is what pointers
+	// taken relative to it (e.g. with copy_state(action_st, st, staging)) refer to.
+	state materialize(const state_snapshot& v) {
+		const state_snapshot* b = v.base.get();
+		if (v.sprites_on_tile_line_size != staging.sprites_on_tile_line.size()) error("state_snapshots: snapshot is not from this staging state");
+
+		(state_base_copyable&)staging = v.copyable;
+		load_vector(staging.tiles, v.tiles, b ? &b->tiles : nullptr);
+		load_vector(staging.tiles_mega_tile_index, v.tiles_mega_tile_index, b ? &b->tiles_mega_tile_index : nullptr);
+		load_vector(staging.repulse_field, v.repulse_field, b ? &b->repulse_field : nullptr);
+
+		if (b) {
+			load_slots(staging.units_container, b->units);
+			load_slots(staging.bullets_container, b->bullets);
+			load_slots(staging.sprites_container, b->sprites);
+			load_slots(staging.images_container, b->images);
+			load_slots(staging.orders_container, b->orders);
+		}
+		load_slots(staging.units_container, v.units);
+		load_slots(staging.bullets_container, v.bullets);
+		load_slots(staging.sprites_container, v.sprites);
+		load_slots(staging.images_container, v.images);
+		load_slots(staging.orders_container, v.orders);
+
+		load_nodes(staging.paths, v.paths);
+		load_nodes(staging.thingies, v.thingies);
+		size_t offset = 0;
+		for_each_list(staging, [&](auto& list) {
+			memcpy((void*)&list, v.lists.data() + offset, sizeof(list));
+			offset += sizeof(list);
+		});
+
+#ifdef BWGAME_GRID_UNIT_FINDER
+		staging.unit_finder_grid = v.unit_finder_grid;
+#else
+		staging.unit_finder_x = v.unit_finder_x;
+		staging.unit_finder_y = v.unit_finder_y;
+#endif
+		staging.consider_collision_with_unit_bug = v.consider_collision_with_unit_bug;
+		staging.prev_bullet_source_unit = v.prev_bullet_source_unit;
+		rebuild_unit_finder_bounding_boxes(staging);
+
+		return copy_state(staging);
+	}
+
+	static size_t memory_usage(const state_snapshot& v) {
+		size_t r = sizeof(v);
+		auto bytes = [&](const state_snapshot::bytes_t& b) {
+			r += b.blocks.capacity() * sizeof(uint32_t) + b.data.capacity();
+		};
+		auto slots = [&](const state_snapshot::slots_t& s) {
+			r += s.positions.capacity() * sizeof(uint16_t) + s.data.capacity();
+		};
+		bytes(v.tiles);
+		bytes(v.tiles_mega_tile_index);
+		bytes(v.repulse_field);
+		slots(v.units);
+		slots(v.bullets);
+		slots(v.sprites);
+		slots(v.images);
+		slots(v.orders);
+		r += v.paths.capacity() * sizeof(path_t) + v.thingies.capacity() * sizeof(thingy_t) + v.lists.capacity();
+		for (auto& p : v.paths) r += p.long_path.capacity() * sizeof(p.long_path[0]) + p.short_path.capacity() * sizeof(p.short_path[0]);
+		r += v.copyable.locations.capacity() * sizeof(location);
+		for (auto& t : v.copyable.running_triggers) r += t.capacity() * sizeof(running_trigger);
+#ifdef BWGAME_GRID_UNIT_FINDER
+		for (auto& c : v.unit_finder_grid.cells) r += sizeof(c) + c.capacity() * sizeof(unit_t*);
+#else
+		r += (v.unit_finder_x.capacity() + v.unit_finder_y.capacity()) * sizeof(state::unit_finder_entry);
+#endif
+		return r;
+	}
+
+private:
+	template<typename F>
+	static void for_each_list(state& st, F&& f) {
+		f(st.visible_units);
+		f(st.hidden_units);
+		f(st.map_revealer_units);
+		f(st.dead_units);
+		for (auto& v : st.player_units) f(v);
+		f(st.cloaked_units);
+		f(st.psionic_matrix_units);
+		f(st.units_container.free_list);
+		f(st.active_bullets);
+		f(st.bullets_container.free_list);
+		f(st.sprites_container.free_list);
+		f(st.images_container.free_list);
+		f(st.orders_container.free_list);
+		f(st.free_paths);
+		f(st.active_thingies);
+		f(st.free_thingies);
+		for (auto& v : st.sprites_on_tile_line) f(v);
+	}
+
+	template<typename T>
+	static void save_vector(state_snapshot::bytes_t& r, a_vector<T>& vec, const state_snapshot::bytes_t* base) {
+		const uint8_t* data = (const uint8_t*)vec.data();
+		r.size = vec.size() * sizeof(T);
+		if (base && base->size != r.size) base = nullptr;
+		for (size_t offset = 0; offset < r.size; offset += block_size) {
+			size_t n = std::min(block_size, r.size - offset);
+			if (base && !memcmp(data + offset, base->data.data() + offset, n)) continue;
+			r.blocks.push_back((uint32_t)(offset / block_size));
+			r.data.insert(r.data.end(), data + offset, data + offset + n);
+		}
+		r.blocks.shrink_to_fit();
+		r.data.shrink_to_fit();
+		a_vector<T>().swap(vec);
+	}
+
+	static void load_bytes(uint8_t* data, const state_snapshot::bytes_t& v) {
+		const uint8_t* src = v.data.data();
+		for (uint32_t block : v.blocks) {
+			size_t offset = block * block_size;
+			size_t n = std::min(block_size, v.size - offset);
+			memcpy(data + offset, src, n);
+			src += n;
+		}
+	}
+
+	template<typename T>
+	static void load_vector(a_vector<T>& vec, const state_snapshot::bytes_t& v, const state_snapshot::bytes_t* base) {
+		vec.resize(v.size / sizeof(T));
+		if (base && base->size == v.size) load_bytes((uint8_t*)vec.data(), *base);
+		load_bytes((uint8_t*)vec.data(), v);
+	}
+
+	template<typename T, size_t max_size, size_t allocation_granularity>
+	static T* slot(object_container<T, max_size, allocation_granularity>& c, size_t position) {
+		return &c.list[position / allocation_granularity][position % allocation_granularity];
+	}
+
+	template<typename T, size_t max_size, size_t allocation_granularity>
+	static void save_slots(state_snapshot::slots_t& r, object_container<T, max_size, allocation_granularity>& c, size_t size, const state_snapshot::slots_t* base) {
+		r.size = size;
+		for (size_t i = 0; i != size; ++i) {
+			const uint8_t* p = (const uint8_t*)slot(c, i);
+			if (base && i < base->size && !memcmp(p, base->data.data() + sizeof(T) * i, sizeof(T))) continue;
+			r.positions.push_back((uint16_t)i);
+			r.data.insert(r.data.end(), p, p + sizeof(T));
+		}
+		r.positions.shrink_to_fit();
+		r.data.shrink_to_fit();
+	}
+
+	template<typename T, size_t max_size, size_t allocation_granularity>
+	static void load_slots(object_container<T, max_size, allocation_granularity>& c, const state_snapshot::slots_t& v) {
+		while (c.size < v.size) c.grow(false);
+		const uint8_t* src = v.data.data();
+		for (uint16_t i : v.positions) {
+			memcpy((void*)slot(c, i), src, sizeof(T));
+			src += sizeof(T);
+		}
+	}
+
+	// path_t owns heap memory, so nodes are copied rather than stored as bytes.
+	template<typename T>
+	static void save_nodes(a_vector<T>& r, a_list<T>& list, size_t n) {
+		r.reserve(n);
+		for (auto i = list.begin(); n; ++i, --n) {
+			r.push_back(*i);
+		}
+	}
+
+	template<typename T>
+	static void load_nodes(a_list<T>& list, const a_vector<T>& v) {
+		if (list.size() < v.size()) error("state_snapshots: snapshot is not from this staging state");
+		auto i = list.begin();
+		for (auto& n : v) {
+			*i++ = n;
+		}
+	}
+};
+
+}
+
+#endif
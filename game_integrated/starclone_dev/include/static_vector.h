@@ -431,6 +431,21 @@ public:
 		m_destroy(ptr_end() - 1);
 		--m_end;
 	}
+	iterator insert(const iterator pos, T value) {
+		if (size() == capacity()) throw std::length_error("static_vector resized beyond capacity");
+		pointer e = ptr_end();
+		if (pos.ptr == e) {
+			new (e) value_type(std::move(value));
+		} else {
+			new (e) value_type(std::move(*(e - 1)));
+			for (pointer i = e - 1; i != pos.ptr; --i) {
+				*i = std::move(*(i - 1));
+			}
+			*pos.ptr = std::move(value);
+		}
+		m_end = e + 1;
+		return pos;
+	}
 	iterator erase(const iterator pos) {
 		for (pointer i = pos.ptr;;) {
 			pointer ni = i + 1;
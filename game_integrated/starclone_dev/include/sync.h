@@ -5,6 +5,8 @@
 #include "actions.h"
 #include "replay.h"
 #include "replay_saver.h"
+#include "state_hash.h"
+#include "mpsc_queue.h"
 
 #include <chrono>
 #include <random>
@@ -107,8 +109,40 @@ struct sync_state {
 
 	int successful_action_count = 0;
 	int failed_action_count = 0;
-	std::array<uint32_t, 4> insync_hash{};
-	uint8_t insync_hash_index = 0;
+	// Every insync_check_interval sync frames, each client sends a hash of its
+	// state, indexed by the low byte of the sync frame, and drops any client whose
+	// hash differs from its own. The hash is state_functions::sync_hash, or
+	// deep_state_hash if deep_insync_hash is set; all clients must use the same
+	// settings. desync_frame is the game frame of the first mismatch.
+	int insync_check_interval = 1;
+	bool deep_insync_hash = false;
+	std::array<uint32_t, 0x100> insync_hash{};
+	std::array<int, 0x100> insync_hash_frame{};
+	int desync_frame = -1;
+	// If set, a quick state_digest of every frame (and a deep one every
+	// digest_log->deep_interval frames) is recorded here, to be compared with
+	// the log of another client by the desync_bisect tool.
+	state_digest_log* digest_log = nullptr;
+
+	// Every action on its way to the scheduled_actions of its client, in the
+	// order it arrived: those received from clients as they are received, and
+	// those queued with sync_functions::queue_action, possibly from other
+	// threads, as they are queued. Each is stamped on arrival with the sync
+	// frame it is scheduled for. The simulation thread schedules them at the
+	// start of sync_functions::next_frame and before it executes scheduled
+	// actions.
+	struct queued_action {
+		// Set for actions from queue_action, which still have to be sent to
+		// the other clients.
+		bool local_input = false;
+		int client_id = 0;
+		uint8_t frame = 0;
+		size_t size = 0;
+		std::array<uint8_t, 0x100> data;
+	};
+	mpsc_queue<queued_action, 0x100> action_queue;
+	// sync_frame, for stamping the actions queued from other threads.
+	std::atomic<int> published_sync_frame{0};
 
 };
 
@@ -189,6 +223,7 @@ struct sync_functions: action_functions {
 
 	template<typename action_F>
 	void execute_scheduled_actions(action_F&& action_f) {
+		end_read_phase();
 		for (auto i = sync_st.clients.begin(); i != sync_st.clients.end();) {
 			sync_state::client_t* c = &*i;
 			++i;
@@ -208,19 +243,30 @@ struct sync_functions: action_functions {
 
 	template<typename server_T>
 	void next_frame(server_T& server) {
+		input_queued_actions(server);
 		sync(server);
 		action_functions::next_frame();
+		if (sync_st.digest_log) sync_st.digest_log->record(st);
 	}
 
 	template<typename server_T>
 	void bwapi_compatible_next_frame(server_T& server) {
 		if (sync_st.is_first_bwapi_compatible_frame) sync_st.is_first_bwapi_compatible_frame = false;
-		else action_functions::next_frame();
+		else {
+			action_functions::next_frame();
+			if (sync_st.digest_log) sync_st.digest_log->record(st);
+		}
+		input_queued_actions(server);
 		sync(server);
 	}
 
 	template<typename reader_T>
 	bool schedule_action(sync_state::client_t* client, reader_T&& r) {
+		return schedule_action(client, (uint8_t)(client->frame + sync_st.latency), r);
+	}
+
+	template<typename reader_T>
+	bool schedule_action(sync_state::client_t* client, uint8_t frame, reader_T&& r) {
 		size_t n = r.left();
 		auto& buffer = client->buffer;
 		auto& buffer_begin = client->buffer_begin;
@@ -276,7 +322,7 @@ struct sync_functions: action_functions {
 		r.get_bytes(buffer.data() + pos, n);
 		a_string str;
 		for (size_t i = 0; i != n; ++i) str += format("%02x", (buffer.data() + pos)[i]);
-		client->scheduled_actions.push_back({(uint8_t)(client->frame + sync_st.latency), pos, buffer_end});
+		client->scheduled_actions.push_back({frame, pos, buffer_end});
 		return true;
 	}
 
@@ -408,12 +454,14 @@ struct sync_functions: action_functions {
 							st.players[i].race = sync_st.initial_slot_races[i];
 						}
 
+						schedule_queued_actions();
 						for (auto* c : ptr(sync_st.clients)) {
 							c->player_slot = -1;
 							clear_scheduled_actions(c);
 							c->frame = 0;
 						}
 						sync_st.sync_frame = 0;
+						sync_st.published_sync_frame.store(0, std::memory_order_relaxed);
 						if (client->h) {
 							server.allow_send(client->h, true);
 						}
@@ -429,11 +477,60 @@ struct sync_functions: action_functions {
 				if (!client->has_uid) kill_client(client);
 				else {
 					r.seek(t);
-					funcs.schedule_action(client, r);
+					push_action(client, r);
 				}
 			}
 		}
 
+		// Queues an action received from client, see sync_state::action_queue.
+		// One that is too large for a queued_action or does not fit in the
+		// queue is scheduled right away, after the ones queued before it.
+		template<typename reader_T>
+		void push_action(sync_state::client_t* client, reader_T&& r) {
+			uint8_t frame = (uint8_t)(client->frame + sync_st.latency);
+			size_t n = r.left();
+			if (n <= std::tuple_size<decltype(sync_state::queued_action::data)>::value) {
+				bool pushed = sync_st.action_queue.try_push([&](sync_state::queued_action& v) {
+					v.local_input = false;
+					v.client_id = client->local_id;
+					v.frame = frame;
+					v.size = n;
+					r.get_bytes(v.data.data(), n);
+				});
+				if (pushed) return;
+			}
+			schedule_queued_actions();
+			funcs.schedule_action(client, frame, r);
+		}
+
+		// Moves the actions in sync_st.action_queue to the scheduled actions of
+		// their clients. Actions of clients that have since been killed are
+		// dropped.
+		// The actions from queue_action are sent to the other clients here.
+		// They schedule an action relative to the last client frame they got
+		// from this client, so one stamped in an earlier sync frame (queued
+		// while next_frame was running) is moved up to the current one.
+		void schedule_queued_actions() {
+			while (sync_st.action_queue.try_pop([&](const sync_state::queued_action& v) {
+				sync_state::client_t* client = nullptr;
+				uint8_t frame = v.frame;
+				if (v.local_input) {
+					client = sync_st.local_client;
+					auto d = server.new_message();
+					d.put(v.data.data(), v.size);
+					server.send_message(d, nullptr);
+					frame = (uint8_t)(client->frame + sync_st.latency);
+				} else {
+					for (auto* c : ptr(sync_st.clients)) {
+						if (c->local_id == v.client_id) client = c;
+					}
+					if (!client) return;
+				}
+				data_loading::data_reader_le r(v.data.data(), v.data.data() + v.size);
+				funcs.schedule_action(client, frame, r);
+			}));
+		}
+
 		void recv(sync_state::client_t* client, const uint8_t* data, size_t data_size) {
 			data_loading::data_reader_le r(data, data + data_size);
 			return recv(client, r);
@@ -630,31 +727,20 @@ struct sync_functions: action_functions {
 			};
 			add(sync_st.successful_action_count);
 			add(sync_st.failed_action_count);
-			add(st.lcg_rand_state);
-			for (auto v : st.current_minerals) add(v);
-			for (auto v : st.current_gas) add(v);
-			for (auto v : st.total_minerals_gathered) add(v);
-			for (auto v : st.total_gas_gathered) add(v);
-			add(st.active_orders_size);
-			add(st.active_bullets_size);
-			add(st.active_thingies_size);
-			for (unit_t* u : ptr(st.visible_units)) {
-				add((u->shield_points + u->hp).raw_value);
-				add(u->exact_position.x.raw_value);
-				add(u->exact_position.y.raw_value);
-			}
+			add(sync_st.deep_insync_hash ? deep_state_hash(st) : funcs.sync_hash());
 
-			if (sync_st.insync_hash_index == sync_st.insync_hash.size() - 1) sync_st.insync_hash_index = 0;
-			else ++sync_st.insync_hash_index;
-			sync_st.insync_hash[sync_st.insync_hash_index] = hash;
+			uint8_t index = (uint8_t)sync_st.sync_frame;
+			sync_st.insync_hash[index] = hash;
+			sync_st.insync_hash_frame[index] = st.current_frame;
 		}
 
 		void send_insync_check() {
+			uint8_t index = (uint8_t)sync_st.sync_frame;
 			writer<7> w;
 			if (sync_st.game_started) w.put<uint8_t>(sync_messages::id_game_started_escape);
 			w.put<uint8_t>(sync_messages::id_insync_check);
-			w.put<uint8_t>(sync_st.insync_hash_index);
-			w.put<uint32_t>(sync_st.insync_hash[sync_st.insync_hash_index]);
+			w.put<uint8_t>(index);
+			w.put<uint32_t>(sync_st.insync_hash[index]);
 			send(w);
 		}
 
@@ -777,6 +863,8 @@ struct sync_functions: action_functions {
 
 		void process_messages() {
 
+			schedule_queued_actions();
+
 			if (sync_st.game_starting_countdown) {
 				--sync_st.game_starting_countdown;
 				if (sync_st.game_starting_countdown == 0) {
@@ -796,6 +884,7 @@ struct sync_functions: action_functions {
 									uint8_t index = r.template get<uint8_t>();
 									uint32_t hash = r.template get<uint32_t>();
 									if (hash != sync_st.insync_hash.at(index)) {
+										if (sync_st.desync_frame == -1) sync_st.desync_frame = sync_st.insync_hash_frame.at(index);
 										this->kill_client(client);
 									}
 									break;
@@ -938,9 +1027,10 @@ struct sync_functions: action_functions {
 				}
 			}
 			++sync_st.sync_frame;
+			sync_st.published_sync_frame.store(sync_st.sync_frame, std::memory_order_relaxed);
 			send_client_frame();
 
-			if (sync_st.game_started && sync_st.sync_frame % 32 == 0) {
+			if (sync_st.game_started && sync_st.sync_frame % std::max(sync_st.insync_check_interval, 1) == 0) {
 				update_insync_hash();
 				send_insync_check();
 			}
@@ -967,6 +1057,7 @@ struct sync_functions: action_functions {
 
 			if (!sync_st.game_started && !sync_st.game_starting_countdown && pred()) {
 				auto any_scheduled_actions = [&]() {
+					schedule_queued_actions();
 					for (auto& c : sync_st.clients) {
 						if (!c.scheduled_actions.empty()) return true;
 					}
@@ -1000,7 +1091,9 @@ struct sync_functions: action_functions {
 			server.set_timeout(std::chrono::milliseconds(250), [&]{
 				timed_out = true;
 			});
-			while (!sync_st.local_client->scheduled_actions.empty() && !timed_out) {
+			while (!timed_out) {
+				schedule_queued_actions();
+				if (sync_st.local_client->scheduled_actions.empty()) break;
 				sync_next_frame();
 				server.poll(std::bind(&syncer_t::on_new_client, this, std::placeholders::_1));
 				while (!all_clients_in_sync() && !timed_out) {
@@ -1106,6 +1199,27 @@ struct sync_functions: action_functions {
 		get_syncer(server).send(data, size);
 	}
 
+	// Like input_action, but can be called from any thread. The action is
+	// stamped with the current sync frame and sent at the start of the next
+	// frame, see sync_state::action_queue. Returns false if the action does not
+	// fit in a sync_state::queued_action or the queue is full.
+	bool queue_action(const uint8_t* data, size_t size) {
+		if (size == 0 || size > std::tuple_size<decltype(sync_state::queued_action::data)>::value) return false;
+		uint8_t frame = (uint8_t)(sync_st.published_sync_frame.load(std::memory_order_relaxed) + sync_st.latency);
+		return sync_st.action_queue.try_push([&](sync_state::queued_action& v) {
+			v.local_input = true;
+			v.client_id = 0;
+			v.frame = frame;
+			v.size = size;
+			std::memcpy(v.data.data(), data, size);
+		});
+	}
+
+	template<typename server_T>
+	void input_queued_actions(server_T& server) {
+		get_syncer(server).schedule_queued_actions();
+	}
+
 	template<typename server_T>
 	void leave_game(server_T& server) {
 		get_syncer(server).leave_game();
@@ -826,12 +826,27 @@ a_string format(const char*fmt, T&&... args) {
 	return str;
 }
 
+// str as a quoted JSON string, for tools that write JSON output.
+inline a_string json_string(const a_string& str) {
+	a_string r = "\"";
+	for (char c : str) {
+		if (c == '"' || c == '\\') {
+			r += '\\';
+			r += c;
+		} else if ((unsigned char)c < 0x20) {
+			r += format("\\u%04x", (int)(unsigned char)c);
+		} else r += c;
+	}
+	r += '"';
+	return r;
+}
+
 struct exception : std::runtime_error {
 	exception(const a_string& str) : std::runtime_error(str.c_str()) {}
 };
 
 template<typename...T>
-void error(const char* fmt, T&&... args) {
+[[noreturn]] void error(const char* fmt, T&&... args) {
 	throw exception(format(fmt, std::forward<T>(args)...));
 }
 
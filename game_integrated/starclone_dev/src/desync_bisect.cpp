@@ -0,0 +1,260 @@
+// Finds where two simulations that should be identical diverge.
+//
+// usage: desync_bisect [-d data_path] [-i interval] [-g digest_log] <log_a> <log_b>
+//        desync_bisect [-d data_path] [-i interval] [-g digest_log] <replay_a> [replay_b]
+//
+// Given two state_digest_log files, as recorded with sync_state::digest_log or
+// with -g, prints the first frame at which they differ and in which subsystems.
+//
+// Given replays, simulates them side by side (the same replay twice if only one
+// is given, which catches nondeterminism in the simulation itself), comparing
+// state_functions::sync_hash every frame and taking a state_copier snapshot of
+// both sides every interval frames where their state_digests match. On the
+// first mismatch, both sides are restored from the last matching snapshot and
+// simulated again comparing state_digests every frame, and the first unit,
+// bullet or sprite and field that differs is printed.
+//
+// -g writes the digest log of every frame of replay_a, with a deep digest
+// every interval frames, so that runs of different builds can be compared with
+// the first form. Quick and deep digests are only compared with their own kind.
+
+#include "bwgame.h"
+#include "replay.h"
+#include "state_hash.h"
+
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+using namespace bwgame;
+
+namespace {
+
+struct side_state {
+	game_state game_st;
+	state st;
+	action_state action_st;
+	replay_state replay_st;
+	explicit side_state(const global_state& global_st) {
+		st.global = &global_st;
+		st.game = &game_st;
+	}
+};
+
+struct side: side_state {
+	replay_functions funcs;
+	side(const global_state& global_st, const a_string& filename) : side_state(global_st), funcs(st, action_st, replay_st) {
+		funcs.load_replay_file(filename);
+	}
+};
+
+struct snapshot {
+	state st;
+	action_state action_st;
+	explicit snapshot(const side& s) : st(copy_state(s.st)), action_st(copy_state(s.action_st, s.st, st)) {}
+	void restore(side& s) const {
+		s.st = copy_state(st);
+		s.action_st = copy_state(action_st, st, s.st);
+	}
+};
+
+bool ends_with(const a_string& str, const char* suffix) {
+	size_t n = strlen(suffix);
+	if (str.size() < n) return false;
+	for (size_t i = 0; i != n; ++i) {
+		if (std::tolower((unsigned char)str[str.size() - n + i]) != suffix[i]) return false;
+	}
+	return true;
+}
+
+a_string differing_subsystems(const state_digest& a, const state_digest& b) {
+	a_string r;
+	for (size_t i = 0; i != state_digest::subsystem_count; ++i) {
+		if (a.hashes[i] == b.hashes[i]) continue;
+		if (!r.empty()) r += " ";
+		r += state_digest::subsystem_name((state_digest::subsystem_t)i);
+	}
+	return r;
+}
+
+int compare_logs(const a_string& filename_a, const a_string& filename_b) {
+	auto a = state_digest_log::load(filename_a);
+	auto b = state_digest_log::load(filename_b);
+	a_map<std::pair<int, bool>, const state_digest*> frames_b;
+	for (auto& v : b) frames_b[{v.frame, v.deep}] = &v;
+	int last_match = -1;
+	size_t compared = 0;
+	for (auto& v : a) {
+		auto i = frames_b.find({v.frame, v.deep});
+		if (i == frames_b.end()) continue;
+		++compared;
+		if (v != *i->second) {
+			printf("first differing %s digest at frame %d (last matching frame %d): %s\n", v.deep ? "deep" : "quick", v.frame, last_match, differing_subsystems(v, *i->second).c_str());
+			return 3;
+		}
+		last_match = v.frame;
+	}
+	if (compared == 0) {
+		printf("the logs have no frames in common\n");
+		return 1;
+	}
+	printf("%d digests compared, last frame %d, no differences\n", (int)compared, last_match);
+	return 0;
+}
+
+a_string describe(const unit_t* u) {
+	if (!u) return "(none)";
+	return format("unit %d type %d owner %d at %d %d", u->index, u->unit_type ? (int)u->unit_type->id : -1, u->owner, u->position.x, u->position.y);
+}
+a_string describe(const bullet_t* b) {
+	if (!b) return "(none)";
+	return format("bullet %d weapon %d at %d %d", b->index, b->weapon_type ? (int)b->weapon_type->id : -1, b->position.x, b->position.y);
+}
+a_string describe(const sprite_t* s) {
+	if (!s) return "(none)";
+	return format("sprite %d type %d at %d %d", s->index, s->sprite_type ? (int)s->sprite_type->id : -1, s->position.x, s->position.y);
+}
+
+// Prints the first object and field that differ in every subsystem that
+// differs between a and b.
+void report_difference(const state& a, const state& b) {
+	state_digest da = get_state_digest(a);
+	state_digest db = get_state_digest(b);
+	printf("first differing frame %d: %s\n", a.current_frame, differing_subsystems(da, db).c_str());
+	auto print = [&](auto* va, auto* vb, const char* field) {
+		if (*field) printf("  %s: field %s differs\n", describe(va).c_str(), field);
+		else printf("  a has %s where b has %s\n", describe(va).c_str(), describe(vb).c_str());
+	};
+	if (da.hashes[state_digest::subsystem_units] != db.hashes[state_digest::subsystem_units]) {
+		diff_objects<unit_t>(a, b, [](state_hasher& h, auto&& f) {h.for_each_unit(f);}, &state_hasher::unit, print);
+	}
+	if (da.hashes[state_digest::subsystem_bullets] != db.hashes[state_digest::subsystem_bullets]) {
+		diff_objects<bullet_t>(a, b, [](state_hasher& h, auto&& f) {h.for_each_bullet(f);}, &state_hasher::bullet, print);
+	}
+	if (da.hashes[state_digest::subsystem_sprites] != db.hashes[state_digest::subsystem_sprites]) {
+		diff_objects<sprite_t>(a, b, [](state_hasher& h, auto&& f) {h.for_each_sprite(f);}, &state_hasher::sprite, print);
+	}
+	if (da.hashes[state_digest::subsystem_random_counts] != db.hashes[state_digest::subsystem_random_counts]) {
+		printf("  lcg_rand_state %08x vs %08x, total_random_counts %d vs %d\n", a.lcg_rand_state, b.lcg_rand_state, a.total_random_counts, b.total_random_counts);
+		for (size_t i = 0; i != a.random_counts.size(); ++i) {
+			if (a.random_counts[i] != b.random_counts[i]) printf("  random_counts[%d]: %d vs %d\n", (int)i, a.random_counts[i], b.random_counts[i]);
+		}
+	}
+	if (da.hashes[state_digest::subsystem_tiles] != db.hashes[state_digest::subsystem_tiles] && a.tiles.size() == b.tiles.size()) {
+		size_t width = a.game->map_tile_width;
+		for (size_t i = 0; i != a.tiles.size(); ++i) {
+			auto& ta = a.tiles[i];
+			auto& tb = b.tiles[i];
+			if (ta.visible != tb.visible || ta.explored != tb.explored || ta.flags != tb.flags) {
+				printf("  first differing tile %d %d: flags %04x vs %04x, visible %02x vs %02x, explored %02x vs %02x\n", (int)(i % width), (int)(i / width), ta.flags, tb.flags, ta.visible, tb.visible, ta.explored, tb.explored);
+				break;
+			}
+		}
+	}
+}
+
+int compare_replays(const global_state& global_st, const a_string& filename_a, const a_string& filename_b, int interval, state_digest_log* digest_log) {
+	side a(global_st, filename_a);
+	side b(global_st, filename_b);
+	if (a.st.tiles.size() != b.st.tiles.size()) error("the replays are not of the same map");
+
+	snapshot last_a(a);
+	snapshot last_b(b);
+	if (get_state_digest(a.st) != get_state_digest(b.st)) {
+		printf("the initial states differ\n");
+		report_difference(a.st, b.st);
+		return 3;
+	}
+
+	bool mismatch = false;
+	while (!a.funcs.is_done() && !b.funcs.is_done()) {
+		a.funcs.next_frame();
+		b.funcs.next_frame();
+		if (digest_log) digest_log->record(a.st);
+		if (a.funcs.sync_hash() != b.funcs.sync_hash()) {
+			mismatch = true;
+			break;
+		}
+		if (a.st.current_frame % interval == 0) {
+			if (get_state_digest(a.st) != get_state_digest(b.st)) {
+				mismatch = true;
+				break;
+			}
+			last_a = snapshot(a);
+			last_b = snapshot(b);
+		}
+	}
+	if (!mismatch) {
+		if (digest_log) {
+			while (!a.funcs.is_done()) {
+				a.funcs.next_frame();
+				digest_log->record(a.st);
+			}
+		}
+		printf("no differences in %d frames\n", std::min(a.st.current_frame, b.st.current_frame));
+		return 0;
+	}
+
+	int detected_frame = a.st.current_frame;
+	last_a.restore(a);
+	last_b.restore(b);
+	printf("mismatch detected at frame %d, simulating again from frame %d\n", detected_frame, a.st.current_frame);
+	while (a.st.current_frame != detected_frame) {
+		a.funcs.next_frame();
+		b.funcs.next_frame();
+		if (get_state_digest(a.st) != get_state_digest(b.st)) break;
+	}
+	report_difference(a.st, b.st);
+	return 3;
+}
+
+}
+
+int main(int argc, char** argv) {
+
+	a_string data_path = ".";
+	int interval = 24;
+	const char* digest_log_filename = nullptr;
+	a_vector<a_string> files;
+	bool bad_args = false;
+
+	for (int i = 1; i < argc; ++i) {
+		if (!strcmp(argv[i], "-d") && i + 1 < argc) data_path = argv[++i];
+		else if (!strcmp(argv[i], "-i") && i + 1 < argc) interval = std::atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-g") && i + 1 < argc) digest_log_filename = argv[++i];
+		else if (argv[i][0] == '-') bad_args = true;
+		else files.push_back(argv[i]);
+	}
+	if (bad_args || files.empty() || files.size() > 2) {
+		fprintf(stderr, "usage: %s [-d data_path] [-i interval] [-g digest_log] <log_a> <log_b>\n", argv[0]);
+		fprintf(stderr, "       %s [-d data_path] [-i interval] [-g digest_log] <replay_a> [replay_b]\n", argv[0]);
+		return 1;
+	}
+	if (interval < 1) interval = 1;
+
+	try {
+		bool replays = ends_with(files[0], ".rep");
+		if (files.size() == 2 && ends_with(files[1], ".rep") != replays) error("give either two digest logs or one or two replays");
+		if (!replays) {
+			if (files.size() != 2) error("two digest logs are needed");
+			return compare_logs(files[0], files[1]);
+		}
+
+		std::shared_ptr<const global_state> global_st;
+		try {
+			global_st = shared_global_state(data_path);
+		} catch (const std::exception& e) {
+			fprintf(stderr, "failed to load data files from %s: %s\n", data_path.c_str(), e.what());
+			return 1;
+		}
+		state_digest_log digest_log(0x100000);
+		digest_log.deep_interval = interval;
+		int r = compare_replays(*global_st, files[0], files.size() == 2 ? files[1] : files[0], interval, digest_log_filename ? &digest_log : nullptr);
+		if (digest_log_filename) digest_log.save(digest_log_filename);
+		return r;
+	} catch (const std::exception& e) {
+		fprintf(stderr, "%s\n", e.what());
+		return 1;
+	}
+}
@@ -0,0 +1,417 @@
+// Deterministic benchmarks for engine hot paths.
+//
+// Loads fixed maps, spawns units at positions drawn from a seeded generator and
+// times engine functions on them, so two builds given the same data files, maps
+// and seed do exactly the same work. Prints ns/op for every case, frames/sec for
+// the next_frame cases and a checksum of the results that should only change
+// when behavior changes.
+//
+// usage: engine_bench [-d data_path] [-s seed] [-n scale] [-f filter] [-o output_file] [map]...
+//
+// The maps default to the ones in game_integrated/maps, relative to the working
+// directory. -n multiplies the number of operations of every case, -f only runs
+// the cases whose name contains filter and -o writes a JSON line per case.
+
+#include "bwgame.h"
+#include "frame_readers.h"
+#include "state_hash.h"
+#include "state_serialization.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+
+using namespace bwgame;
+
+namespace {
+
+struct bench_result {
+	a_string map;
+	a_string name;
+	size_t units = 0;
+	size_t ops = 0;
+	double seconds = 0.0;
+	uint64_t checksum = 0;
+};
+
+struct bench_context {
+	std::shared_ptr<const global_state> global_st;
+	a_vector<bench_result> results;
+	a_string map;
+	uint32_t seed = 1;
+	size_t scale = 1;
+	a_string filter;
+
+	bool enabled(const char* name) const {
+		return filter.empty() || strstr(name, filter.c_str());
+	}
+
+	template<typename F>
+	void run(const char* name, size_t units, size_t ops, F&& f) {
+		if (!enabled(name)) return;
+		ops *= scale;
+		bench_result r;
+		r.map = map;
+		r.name = name;
+		r.units = units;
+		r.ops = ops;
+		auto start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i != ops; ++i) {
+			r.checksum = r.checksum * 31 + f(i);
+		}
+		r.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		double ns = r.seconds * 1e9 / r.ops;
+		printf("%-28s %-32s %5d units %8d ops %12.1f ns/op %10.1f ops/s  %016llx\n", map.c_str(), name, (int)units, (int)ops, ns, r.ops / r.seconds, (unsigned long long)r.checksum);
+		fflush(stdout);
+		results.push_back(std::move(r));
+	}
+};
+
+struct bench_game {
+	game_player player;
+	std::mt19937 rng;
+
+	bench_game(const bench_context& ctx, uint32_t seed) : player(ctx.global_st), rng(seed) {
+		player.load_map_file(ctx.map);
+	}
+
+	state& st() {
+		return player.st();
+	}
+	state_functions& funcs() {
+		return player.funcs();
+	}
+
+	xy random_position() {
+		return xy((int)(rng() % st().game->map_width), (int)(rng() % st().game->map_height));
+	}
+
+	xy random_walkable_position() {
+		for (size_t i = 0; i != 0x1000; ++i) {
+			xy pos = random_position();
+			if (funcs().get_region_at(pos)->walkable()) return pos;
+		}
+		error("no walkable position found");
+	}
+
+	size_t spawn_units(size_t n) {
+		static const std::array<UnitTypes, 6> types = {
+			UnitTypes::Terran_Marine, UnitTypes::Zerg_Zergling, UnitTypes::Protoss_Dragoon,
+			UnitTypes::Terran_Vulture, UnitTypes::Zerg_Hydralisk, UnitTypes::Protoss_Zealot
+		};
+		size_t created = 0;
+		for (size_t attempts = 0; created != n && attempts != n * 20; ++attempts) {
+			const unit_type_t* unit_type = funcs().get_unit_type(types[rng() % types.size()]);
+			unit_t* u = funcs().create_unit(unit_type, random_walkable_position(), (int)(created % 2));
+			if (!u) continue;
+			funcs().finish_building_unit(u);
+			funcs().complete_unit(u);
+			++created;
+		}
+		return created;
+	}
+
+	// Sends every unit of players 0 and 1 to attack move to a random position.
+	void issue_orders() {
+		funcs().end_read_phase();
+		for (int owner = 0; owner != 2; ++owner) {
+			for (unit_t* u : ptr(st().player_units[owner])) {
+				if (!funcs().unit_can_move(u)) continue;
+				funcs().set_unit_order(u, funcs().get_order_type(Orders::AttackMove), random_walkable_position());
+			}
+		}
+	}
+
+	a_vector<unit_t*> units() {
+		a_vector<unit_t*> r;
+		for (unit_t* u : ptr(st().visible_units)) r.push_back(u);
+		return r;
+	}
+};
+
+void run_map(bench_context& ctx) {
+	a_vector<uint8_t> map_data;
+	{
+		data_loading::file_reader<> r(ctx.map);
+		map_data = r.get_vec<uint8_t>(r.size());
+	}
+	ctx.run("decompress scenario.chk", 0, 200, [&](size_t) {
+		data_loading::mpq_data mpq(map_data.data(), map_data.size());
+		a_vector<uint8_t> chk;
+		mpq(chk, "staredit\\scenario.chk");
+		return chk.size();
+	});
+
+	bench_game game(ctx, ctx.seed);
+	size_t units = game.spawn_units(200);
+	auto& funcs = game.funcs();
+
+	a_vector<std::pair<xy, xy>> pairs;
+	for (size_t i = 0; i != 256; ++i) pairs.emplace_back(game.random_walkable_position(), game.random_walkable_position());
+
+	ctx.run("pathfinder_find_long_path", units, 2000, [&](size_t i) {
+		auto& v = pairs[i % pairs.size()];
+		state_functions::pathfinder pf;
+		funcs.pathfinder_find_long_path(pf, v.first, v.second);
+		return pf.long_path.size();
+	});
+
+	ctx.run("region_distance", units, 200000, [&](size_t i) {
+		auto& v = pairs[i % pairs.size()];
+		return (size_t)funcs.region_distance(funcs.get_region_at(v.first), funcs.get_region_at(v.second));
+	});
+
+	ctx.run("region_path", units, 2000, [&](size_t i) {
+		auto& v = pairs[i % pairs.size()];
+		return funcs.region_path(funcs.get_region_at(v.first), funcs.get_region_at(v.second)).size();
+	});
+
+	// Long paths are found up front; only the first short path of each is timed.
+	a_vector<unit_t*> movers;
+	for (unit_t* u : game.units()) {
+		if (funcs.unit_can_move(u) && !funcs.u_flying(u)) movers.push_back(u);
+	}
+	a_vector<state_functions::pathfinder> short_paths;
+	for (size_t i = 0; i != pairs.size() && !movers.empty(); ++i) {
+		state_functions::pathfinder pf;
+		pf.u = movers[i % movers.size()];
+		pf.source = pf.u->sprite->position;
+		pf.destination = pairs[i].second;
+		if (!funcs.pathfinder_find_long_path(pf, pf.source, pf.destination)) continue;
+		pf.current_long_path_index = (size_t)0 - 1;
+		short_paths.push_back(std::move(pf));
+	}
+	if (!short_paths.empty()) {
+		ctx.run("pathfinder_find_short_path", units, 2000, [&](size_t i) {
+			state_functions::pathfinder pf = short_paths[i % short_paths.size()];
+			funcs.pathfinder_find(pf, true);
+			return pf.short_path.size();
+		});
+	}
+
+	// Every mover to the same destination, as for a group move order.
+	auto group_long_paths = [&](size_t i, bool share_by_region) {
+		a_vector<state_functions::pathfinder> group(movers.size());
+		for (size_t n = 0; n != movers.size(); ++n) {
+			group[n].source = movers[n]->sprite->position;
+			group[n].destination = pairs[i % pairs.size()].second;
+		}
+		size_t r = funcs.pathfinder_find_long_paths(group, share_by_region);
+		for (auto& pf : group) r = r * 31 + pf.long_path.size();
+		return r;
+	};
+	ctx.run("pathfinder_find_long_paths", movers.size(), 20, [&](size_t i) {
+		return group_long_paths(i, false);
+	});
+	ctx.run("pathfinder_find_long_paths by region", movers.size(), 20, [&](size_t i) {
+		return group_long_paths(i, true);
+	});
+
+	// 256 destinations, more than the flow field cache holds, so most
+	// operations build a field.
+	ctx.run("flow_field_next_waypoint", units, 2000, [&](size_t i) {
+		auto& v = pairs[i % pairs.size()];
+		auto r = funcs.flow_field_next_waypoint(v.first, v.second);
+		return r.first ? (size_t)r.second.x * 0x10000 + r.second.y : 0;
+	});
+
+	ctx.run("find_units 256x256", units, 200000, [&](size_t i) {
+		xy pos = pairs[i % pairs.size()].first;
+		size_t n = 0;
+		for (unit_t* u : funcs.find_units_noexpand({pos - xy(128, 128), pos + xy(128, 128)})) {
+			(void)u;
+			++n;
+		}
+		return n;
+	});
+
+	ctx.run("reveal_sight_at", units, 100000, [&](size_t i) {
+		xy pos = pairs[i % pairs.size()].first;
+		funcs.reveal_sight_at(pos, 8, 1 << (i % 8), i % 2 != 0);
+		return (size_t)funcs.tile_visibility(pos);
+	});
+
+	ctx.run("reset_tiles_visibility", units, 20000, [&](size_t i) {
+		funcs.reset_tiles_visibility();
+		return (size_t)funcs.tile_visibility(pairs[i % pairs.size()].first);
+	});
+
+	a_vector<unit_t*> all_units = game.units();
+	ctx.run("iscript_execute", units, 200000, [&](size_t i) {
+		unit_t* u = all_units[i % all_units.size()];
+		funcs.iscript_unit = u;
+		funcs.iscript_flingy = u;
+		funcs.iscript_execute(u->sprite->main_image, u->sprite->main_image->iscript_state);
+		funcs.iscript_unit = nullptr;
+		funcs.iscript_flingy = nullptr;
+		return (size_t)u->sprite->main_image->frame_index;
+	});
+
+	for (size_t n : {200, 800, 1600}) {
+		a_string name = format("next_frame %d", n);
+		bool copier = n == 1600 && ctx.enabled("state_copier");
+		if (!ctx.enabled(name.c_str()) && !copier) continue;
+		bench_game frames(ctx, ctx.seed + (uint32_t)n);
+		size_t spawned = frames.spawn_units(n);
+		frames.issue_orders();
+		for (int i = 0; i != 24; ++i) frames.player.next_frame();
+		ctx.run(name.c_str(), spawned, 240, [&](size_t i) {
+			frames.player.next_frame();
+			if (i % 240 == 239) frames.issue_orders();
+			return (size_t)frames.st().lcg_rand_state;
+		});
+		if (copier) {
+			ctx.run("state_copier", spawned, 200, [&](size_t) {
+				state copy = copy_state(frames.st());
+				return (size_t)copy.active_orders_size;
+			});
+		}
+	}
+
+	// save_state and load_state on the next_frame 1600 scenario. The loaded
+	// state must have the same digest as the saved one, and stay in sync with it
+	// when both are simulated further.
+	if (ctx.enabled("save_state") || ctx.enabled("load_state")) {
+		bench_game frames(ctx, ctx.seed + 1600);
+		size_t spawned = frames.spawn_units(1600);
+		frames.issue_orders();
+		for (int i = 0; i != 24; ++i) frames.player.next_frame();
+		a_vector<uint8_t> data = save_state(frames.st());
+		ctx.run("save_state", spawned, 200, [&](size_t) {
+			data = save_state(frames.st());
+			return data.size();
+		});
+		game_player loaded = frames.player.fork();
+		ctx.run("load_state", spawned, 200, [&](size_t) {
+			load_state(loaded.st(), data.data(), data.size());
+			return (size_t)loaded.st().active_orders_size;
+		});
+		load_state(loaded.st(), data.data(), data.size());
+		if (get_state_digest(loaded.st()) != get_state_digest(frames.st())) error("load_state: loaded state differs from the saved state");
+		for (int i = 0; i != 240; ++i) {
+			frames.player.next_frame();
+			loaded.next_frame();
+		}
+		if (get_state_digest(loaded.st()) != get_state_digest(frames.st())) error("load_state: loaded state diverged after 240 frames");
+	}
+
+	// The same scenario as next_frame 1600, with ground units following flow
+	// fields instead of the pathfinder.
+	if (ctx.enabled("next_frame 1600 flow_field")) {
+		bench_game frames(ctx, ctx.seed + 1600);
+		frames.st().game->flow_field_movement = true;
+		size_t spawned = frames.spawn_units(1600);
+		frames.issue_orders();
+		for (int i = 0; i != 24; ++i) frames.player.next_frame();
+		ctx.run("next_frame 1600 flow_field", spawned, 240, [&](size_t i) {
+			frames.player.next_frame();
+			if (i % 240 == 239) frames.issue_orders();
+			return (size_t)frames.st().lcg_rand_state;
+		});
+	}
+
+	// The same scenario as next_frame 1600, with readers walking the units of
+	// each frame on worker threads.
+	for (auto mode : {frame_readers::mode_barrier, frame_readers::mode_snapshot}) {
+		a_string name = mode == frame_readers::mode_barrier ? "next_frame 1600 frame_readers" : "next_frame 1600 frame_readers snapshot";
+		if (!ctx.enabled(name.c_str())) continue;
+		bench_game frames(ctx, ctx.seed + 1600);
+		size_t spawned = frames.spawn_units(1600);
+		frames.issue_orders();
+		for (int i = 0; i != 24; ++i) frames.player.next_frame();
+		frame_readers readers(4, mode);
+		std::array<size_t, 4> sums{};
+		for (auto& sum : sums) {
+			readers.add([&sum](const state& st) {
+				for (const unit_t* u : ptr(st.visible_units)) sum += u->hp.raw_value;
+			});
+		}
+		frames.funcs().read_phase = &readers;
+		ctx.run(name.c_str(), spawned, 240, [&](size_t i) {
+			frames.player.next_frame();
+			if (i % 240 == 239) frames.issue_orders();
+			return (size_t)frames.st().lcg_rand_state;
+		});
+		readers.wait();
+		frames.funcs().read_phase = nullptr;
+	}
+
+	// The same scenario as next_frame 1600, with sight tiles cached and
+	// computed ahead of the visibility refresh.
+	if (ctx.enabled("next_frame 1600 cache_sight_tiles")) {
+		bench_game frames(ctx, ctx.seed + 1600);
+		frames.funcs().cache_sight_tiles = true;
+		size_t spawned = frames.spawn_units(1600);
+		frames.issue_orders();
+		for (int i = 0; i != 24; ++i) frames.player.next_frame();
+		ctx.run("next_frame 1600 cache_sight_tiles", spawned, 240, [&](size_t i) {
+			frames.player.next_frame();
+			if (i % 240 == 239) frames.issue_orders();
+			return (size_t)frames.st().lcg_rand_state;
+		});
+	}
+}
+
+}
+
+int main(int argc, char** argv) {
+
+	a_string data_path = ".";
+	const char* output_filename = nullptr;
+	bench_context ctx;
+	a_vector<a_string> maps;
+
+	for (int i = 1; i < argc; ++i) {
+		if (!strcmp(argv[i], "-d") && i + 1 < argc) data_path = argv[++i];
+		else if (!strcmp(argv[i], "-s") && i + 1 < argc) ctx.seed = (uint32_t)std::strtoul(argv[++i], nullptr, 0);
+		else if (!strcmp(argv[i], "-n") && i + 1 < argc) ctx.scale = (size_t)std::atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-f") && i + 1 < argc) ctx.filter = argv[++i];
+		else if (!strcmp(argv[i], "-o") && i + 1 < argc) output_filename = argv[++i];
+		else if (argv[i][0] == '-') {
+			fprintf(stderr, "usage: %s [-d data_path] [-s seed] [-n scale] [-f filter] [-o output_file] [map]...\n", argv[0]);
+			return 1;
+		} else maps.push_back(argv[i]);
+	}
+	if (maps.empty()) {
+		maps.push_back("maps/(2)Astral Balance.scm");
+		maps.push_back("maps/(6)New Super.scm");
+	}
+	if (ctx.scale == 0) ctx.scale = 1;
+
+	try {
+		ctx.global_st = shared_global_state(data_path);
+	} catch (const std::exception& e) {
+		fprintf(stderr, "failed to load data files from %s: %s\n", data_path.c_str(), e.what());
+		return 1;
+	}
+
+	int failed = 0;
+	for (auto& map : maps) {
+		ctx.map = map;
+		try {
+			run_map(ctx);
+		} catch (const std::exception& e) {
+			fprintf(stderr, "%s: %s\n", map.c_str(), e.what());
+			++failed;
+		}
+	}
+
+	if (output_filename) {
+		FILE* output = fopen(output_filename, "wb");
+		if (!output) {
+			fprintf(stderr, "failed to open %s for writing\n", output_filename);
+			return 1;
+		}
+		for (auto& v : ctx.results) {
+			a_string line = "{\"map\":" + json_string(v.map) + ",\"case\":" + json_string(v.name);
+			line += format(",\"units\":%d,\"ops\":%d,\"seconds\":%.6f", v.units, v.ops, v.seconds);
+			line += format(",\"ns_per_op\":%.1f,\"ops_per_second\":%.1f,\"checksum\":\"%016x\"}", v.seconds * 1e9 / v.ops, v.ops / v.seconds, v.checksum);
+			fprintf(output, "%s\n", line.c_str());
+		}
+		fclose(output);
+	}
+
+	return failed ? 2 : 0;
+}
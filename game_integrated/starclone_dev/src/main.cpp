@@ -1222,10 +1222,12 @@ int main(int argc, char** argv) {
     install_crash_handlers();
     log("=== OpenBW 완전 플레이 가능 게임 ===\n");
     
-    auto load_data_file = data_loading::data_files_directory(".");
+    // 데이터 파일 캐시 (data_files_cache.h)
+    const char* data_cache_filename = "bwgame_data.cache";
     
     log("게임 플레이어 초기화 중...\n");
-    game_player player(load_data_file);
+    game_player player;
+    player.init(".", data_cache_filename);
     
     try {
         log("맵 로딩 중...\n");
@@ -1256,7 +1258,7 @@ int main(int argc, char** argv) {
     player_game game(std::move(player));
     
     try {
-        game.ui.init();
+        game.ui.init(".", data_cache_filename);
         log("UI 초기화 성공!\n");
     } catch (const std::exception& e) {
         log("UI 초기화 실패: %s\n", e.what());
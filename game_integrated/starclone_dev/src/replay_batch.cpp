@@ -0,0 +1,240 @@
+// Headless batch replay simulator.
+//
+// Simulates every replay it is given to its last frame without any ui, using a
+// pool of worker threads that all share one read-only global_state, and prints a
+// JSON line summary per replay as soon as it finishes. Replays finish out of
+// order, so each summary holds the index of the replay in the list of replays.
+//
+// usage: replay_batch [-d data_path] [-c cache_file] [-j threads] [-o output_file] [-p] <replay or directory>...
+//
+// With -c, the files loaded from the data files are kept in cache_file (see
+// data_files_cache.h), which later runs load them from instead.
+//
+// When built with BWGAME_FRAME_PROFILER, -p adds the frame_profiler histograms
+// for the whole replay to each summary.
+
+#include "bwgame.h"
+#include "replay.h"
+#include "data_files_cache.h"
+
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <thread>
+
+using namespace bwgame;
+
+namespace {
+
+struct replay_summary {
+	a_string filename;
+	a_string error;
+	a_string map_name;
+	int end_frame = 0;
+	int frames_simulated = 0;
+	double seconds = 0.0;
+	uint32_t lcg_rand_state = 0;
+	int total_random_counts = 0;
+	struct player_summary {
+		int slot;
+		a_string name;
+		race_t race;
+		int minerals_gathered;
+		int gas_gathered;
+		int unit_score;
+		int building_score;
+		int units_alive;
+	};
+	a_vector<player_summary> players;
+	a_string profile;
+};
+
+replay_summary simulate_replay(const global_state& global_st, const a_string& filename, bool profile) {
+	replay_summary r;
+	r.filename = filename;
+	auto start = std::chrono::steady_clock::now();
+	try {
+		game_state game_st;
+		state st;
+		st.global = &global_st;
+		st.game = &game_st;
+		action_state action_st;
+		replay_state replay_st;
+		replay_functions funcs(st, action_st, replay_st);
+		funcs.load_replay_file(filename);
+		r.map_name = replay_st.map_name;
+		r.end_frame = replay_st.end_frame;
+#ifdef BWGAME_FRAME_PROFILER
+		frame_profiler profiler(profile ? replay_st.end_frame + 1 : 0);
+		if (profile) funcs.profiler = &profiler;
+#endif
+		while (!funcs.is_done()) {
+			funcs.next_frame();
+		}
+#ifdef BWGAME_FRAME_PROFILER
+		if (profile) r.profile = profiler.json();
+#endif
+		r.frames_simulated = st.current_frame;
+		r.lcg_rand_state = st.lcg_rand_state;
+		r.total_random_counts = st.total_random_counts;
+		for (size_t i = 0; i != 8; ++i) {
+			if (replay_st.player_name[i].empty()) continue;
+			int units_alive = 0;
+			for (unit_t* u : ptr(st.player_units[i])) {
+				(void)u;
+				++units_alive;
+			}
+			r.players.push_back({(int)i, replay_st.player_name[i], st.players[i].race, st.total_minerals_gathered[i], st.total_gas_gathered[i], st.unit_score[i], st.building_score[i], units_alive});
+		}
+	} catch (const std::exception& e) {
+		r.error = e.what();
+	}
+	r.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return r;
+}
+
+const char* race_name(race_t race) {
+	switch (race) {
+	case race_t::zerg: return "zerg";
+	case race_t::terran: return "terran";
+	case race_t::protoss: return "protoss";
+	default: return "none";
+	}
+}
+
+a_string summary_json(size_t index, const replay_summary& r) {
+	a_string s = format("{\"index\":%d,\"file\":", index) + json_string(r.filename);
+	if (!r.error.empty()) {
+		s += ",\"error\":" + json_string(r.error);
+	}
+	s += ",\"map\":" + json_string(r.map_name);
+	s += format(",\"end_frame\":%d,\"frames\":%d,\"seconds\":%.3f", r.end_frame, r.frames_simulated, r.seconds);
+	s += format(",\"lcg_rand_state\":%u,\"total_random_counts\":%d", r.lcg_rand_state, r.total_random_counts);
+	s += ",\"players\":[";
+	for (size_t i = 0; i != r.players.size(); ++i) {
+		auto& p = r.players[i];
+		if (i) s += ",";
+		s += format("{\"slot\":%d,\"name\":%s,\"race\":\"%s\"", p.slot, json_string(p.name), race_name(p.race));
+		s += format(",\"minerals_gathered\":%d,\"gas_gathered\":%d", p.minerals_gathered, p.gas_gathered);
+		s += format(",\"unit_score\":%d,\"building_score\":%d,\"units_alive\":%d}", p.unit_score, p.building_score, p.units_alive);
+	}
+	s += "]";
+	if (!r.profile.empty()) s += ",\"profile\":" + r.profile;
+	s += "}";
+	return s;
+}
+
+void add_replays(a_vector<a_string>& replays, const char* path) {
+	namespace fs = std::filesystem;
+	std::error_code ec;
+	if (fs::is_directory(path, ec)) {
+		a_vector<a_string> found;
+		for (auto& v : fs::recursive_directory_iterator(path, ec)) {
+			if (!v.is_regular_file()) continue;
+			a_string ext = v.path().extension().string().c_str();
+			for (auto& c : ext) c = (char)std::tolower((unsigned char)c);
+			if (ext == ".rep") found.push_back(v.path().string().c_str());
+		}
+		std::sort(found.begin(), found.end());
+		for (auto& v : found) replays.push_back(std::move(v));
+	} else {
+		replays.push_back(path);
+	}
+}
+
+}
+
+int main(int argc, char** argv) {
+
+	a_string data_path = ".";
+	const char* cache_filename = nullptr;
+	size_t threads = std::thread::hardware_concurrency();
+	const char* output_filename = nullptr;
+	bool profile = false;
+	a_vector<a_string> replays;
+
+	for (int i = 1; i < argc; ++i) {
+		if (!strcmp(argv[i], "-d") && i + 1 < argc) data_path = argv[++i];
+		else if (!strcmp(argv[i], "-c") && i + 1 < argc) cache_filename = argv[++i];
+		else if (!strcmp(argv[i], "-j") && i + 1 < argc) threads = (size_t)std::atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-o") && i + 1 < argc) output_filename = argv[++i];
+		else if (!strcmp(argv[i], "-p")) profile = true;
+		else add_replays(replays, argv[i]);
+	}
+	if (replays.empty()) {
+		fprintf(stderr, "usage: %s [-d data_path] [-c cache_file] [-j threads] [-o output_file] [-p] <replay or directory>...\n", argv[0]);
+		return 1;
+	}
+#ifndef BWGAME_FRAME_PROFILER
+	if (profile) {
+		fprintf(stderr, "-p requires a build with BWGAME_FRAME_PROFILER\n");
+		return 1;
+	}
+#endif
+	if (threads == 0) threads = 1;
+	if (threads > replays.size()) threads = replays.size();
+
+	FILE* output = stdout;
+	if (output_filename) {
+		output = fopen(output_filename, "wb");
+		if (!output) {
+			fprintf(stderr, "failed to open %s for writing\n", output_filename);
+			return 1;
+		}
+	}
+
+	std::shared_ptr<const global_state> global_st;
+	try {
+		if (cache_filename) {
+			auto load_data_file = data_loading::data_files_directory(data_path);
+			load_data_file.thread_count = std::thread::hardware_concurrency();
+			data_loading::data_files_cache<> cache(std::move(load_data_file), cache_filename);
+			global_st = default_global_state_cache().get(data_path, cache);
+			try {
+				cache.save();
+			} catch (const std::exception& e) {
+				fprintf(stderr, "failed to save %s: %s\n", cache_filename, e.what());
+			}
+		} else {
+			global_st = shared_global_state(data_path);
+		}
+	} catch (const std::exception& e) {
+		fprintf(stderr, "failed to load data files from %s: %s\n", data_path.c_str(), e.what());
+		return 1;
+	}
+
+	std::mutex output_mut;
+	size_t failed = 0;
+	size_t total_frames = 0;
+	std::atomic<size_t> next_index{0};
+	auto worker = [&]() {
+		while (true) {
+			size_t index = next_index++;
+			if (index >= replays.size()) break;
+			replay_summary r = simulate_replay(*global_st, replays[index], profile);
+			a_string line = summary_json(index, r);
+			std::lock_guard<std::mutex> l(output_mut);
+			if (!r.error.empty()) ++failed;
+			total_frames += r.frames_simulated;
+			fprintf(output, "%s\n", line.c_str());
+			fflush(output);
+		}
+	};
+
+	auto start = std::chrono::steady_clock::now();
+	a_vector<std::thread> pool;
+	for (size_t i = 1; i < threads; ++i) pool.emplace_back(worker);
+	worker();
+	for (auto& v : pool) v.join();
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	if (output != stdout) fclose(output);
+
+	fprintf(stderr, "%d replays (%d failed), %d frames in %.2fs using %d threads\n", (int)replays.size(), (int)failed, (int)total_frames, seconds, (int)threads);
+
+	return failed ? 2 : 0;
+}
@@ -920,6 +920,24 @@ struct ui_functions: ui_util_functions {
 		load_all_image_data(load_data_file);
 	}
 
+	// Calls init with load_data_file reading the archives in data_path through
+	// a data_files_cache in cache_filename, which is written once the images
+	// are loaded. Sounds loaded later also go through the cache, but are not
+	// written to it.
+	void init(a_string data_path, a_string cache_filename) {
+		auto loader = data_loading::data_files_directory(data_path);
+		loader.thread_count = std::thread::hardware_concurrency();
+		auto cache = std::make_shared<data_loading::data_files_cache<>>(std::move(loader), std::move(cache_filename));
+		load_data_file = [cache](a_vector<uint8_t>& data, a_string filename) {
+			(*cache)(data, std::move(filename));
+		};
+		init();
+		try {
+			cache->save();
+		} catch (const exception&) {
+		}
+	}
+
 	virtual void on_action(int owner, int action) override {
 		apm.at(owner).add_action(st.current_frame);
 	}
@@ -1569,6 +1587,30 @@ struct ui_functions: ui_util_functions {
 	}
 
 	int replay_frame = 0;
+	// Set when the replay slider or backspace moves replay_frame; otherwise
+	// replay_frame follows the current frame as the replay plays.
+	bool replay_seek_pending = false;
+	replay_keyframes keyframes;
+
+	// Moves the replay to replay_frame, restoring the nearest keyframe when
+	// going backwards or when it is ahead of the current frame.
+	void seek_replay() {
+		if (replay_frame > replay_st.end_frame) replay_frame = replay_st.end_frame;
+		if (replay_frame < 0) replay_frame = 0;
+		keyframes.save(st, action_st);
+		auto* v = keyframes.find(replay_frame);
+		if (v && (replay_frame < st.current_frame || v->frame > st.current_frame)) {
+			// Readers of the last frame must be done with st before it is replaced.
+			end_read_phase();
+			keyframes.restore(*v, st, action_st);
+		} else if (replay_frame < st.current_frame) {
+			replay_frame = st.current_frame;
+		}
+		while (st.current_frame < replay_frame) {
+			next_frame();
+			keyframes.save(st, action_st);
+		}
+	}
 
 	rect get_replay_slider_area() {
 #ifdef EMSCRIPTEN
@@ -1946,6 +1988,7 @@ struct ui_functions: ui_util_functions {
 			if (x < 0) x = 0;
 			if (x >= ow) x = ow - 1;
 			replay_frame = x * replay_st.end_frame / ow;
+			replay_seek_pending = true;
 		};
 
 		auto check_move_replay_slider = [&](auto& e) {
@@ -2085,8 +2128,8 @@ struct ui_functions: ui_util_functions {
 					}
 					if (e.sym == '\b') {
 						int t = 5 * 42 / 1000;
-						if (replay_frame < t) replay_frame = 0;
-						else replay_frame -= t;
+						replay_frame = st.current_frame < t ? 0 : st.current_frame - t;
+						replay_seek_pending = true;
 					}
 #endif
 					break;
@@ -2094,6 +2137,16 @@ struct ui_functions: ui_util_functions {
 			}
 		}
 
+		if (replay_st.end_frame) {
+			if (replay_seek_pending) {
+				replay_seek_pending = false;
+				seek_replay();
+			} else {
+				replay_frame = st.current_frame;
+				keyframes.save(st, action_st);
+			}
+		}
+
 		if (!indexed_surface) {
 			if (wnd) {
 				window_surface = native_window_drawing::get_window_surface(&wnd);
@@ -2367,6 +2420,8 @@ struct ui_functions: ui_util_functions {
 	void reset() {
 		apm = {};
 		replay_frame = 0;
+		replay_seek_pending = false;
+		keyframes.clear();
 		auto& game = *st.game;
 		st = state();
 		game = game_state();